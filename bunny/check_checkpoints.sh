@@ -0,0 +1,38 @@
+#!/bin/sh
+# Check that a run which loads its flow graph from a checkpoint writes the
+# same mesh and flow graph file as a fresh run with the same seed.
+#
+# Usage: check_checkpoints.sh <path-to-vascularize>
+
+set -e
+
+vasc=$(realpath "$1")
+case_dir=$(dirname "$(realpath "$0")")
+work=$(mktemp -d)
+
+trap 'rm -rf "$work"' EXIT
+
+cp "$case_dir/bunny_low.obj" "$work/"
+
+run() {
+    grep -v '^output:' "$case_dir/control.txt" > "$work/control.txt"
+    printf 'output: %s.obj\nflow_graph_output: %s.bin\nseed: 1234\n' \
+        "$1" "$1" >> "$work/control.txt"
+
+    if [ -n "$2" ]; then
+        printf 'checkpoint_dir: %s\n' "$2" >> "$work/control.txt"
+    fi
+
+    "$vasc" "$work/control.txt" > /dev/null
+}
+
+run fresh
+run saved checkpoints
+run loaded checkpoints
+
+for name in saved loaded; do
+    cmp "$work/fresh.obj" "$work/$name.obj"
+    cmp "$work/fresh.bin" "$work/$name.bin"
+done
+
+echo "Checkpointed runs match the fresh run."
@@ -0,0 +1,156 @@
+#include "border_points.h"
+
+#include "xrange.h"
+
+#include <algorithm>
+#include <limits>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#    define VASC_X86_KERNELS 1
+#    include <immintrin.h>
+#endif
+
+// GCC would fuse the kernels' multiplies and adds where FMA is available,
+// which changes rounding; keep them apart so every kernel agrees exactly
+#if defined(__GNUC__) && !defined(__clang__)
+#    pragma GCC optimize("fp-contract=off")
+#endif
+
+/// Point counts are padded to a multiple of this; the AVX-512 float width
+constexpr size_t PADDING = 16;
+
+/// Padding coordinate. Far from any voxel, but its square is still finite.
+constexpr float FAR_AWAY = 1e18F;
+
+BorderPoints::BorderPoints(std::vector<glm::vec3> const& points)
+    : m_count(points.size()) {
+
+    size_t const padded = (m_count + PADDING - 1) / PADDING * PADDING;
+
+    m_x.resize(padded, FAR_AWAY);
+    m_y.resize(padded, FAR_AWAY);
+    m_z.resize(padded, FAR_AWAY);
+
+    for (size_t i : xrange(m_count)) {
+        m_x[i] = points[i].x;
+        m_y[i] = points[i].y;
+        m_z[i] = points[i].z;
+    }
+}
+
+///
+/// \brief Scalar scan, for CPUs without vector kernels.
+///
+/// All kernels sum in the same order, (dx² + dy²) + dz², without fused
+/// multiply adds, so they agree exactly.
+///
+static float scan_scalar(float const* xs,
+                         float const* ys,
+                         float const* zs,
+                         size_t       count,
+                         glm::vec3    q) {
+    float best = std::numeric_limits<float>::max();
+
+    for (size_t i : xrange(count)) {
+        float dx = xs[i] - q.x;
+        float dy = ys[i] - q.y;
+        float dz = zs[i] - q.z;
+
+        float d = dx * dx + dy * dy;
+        d       = d + dz * dz;
+
+        best = std::min(best, d);
+    }
+
+    return best;
+}
+
+#ifdef VASC_X86_KERNELS
+
+__attribute__((target("avx2"))) static float scan_avx2(float const* xs,
+                                                      float const* ys,
+                                                      float const* zs,
+                                                      size_t       count,
+                                                      glm::vec3    q) {
+    __m256 qx   = _mm256_set1_ps(q.x);
+    __m256 qy   = _mm256_set1_ps(q.y);
+    __m256 qz   = _mm256_set1_ps(q.z);
+    __m256 best = _mm256_set1_ps(std::numeric_limits<float>::max());
+
+    for (size_t i = 0; i < count; i += 8) {
+        __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(xs + i), qx);
+        __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(ys + i), qy);
+        __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(zs + i), qz);
+
+        __m256 d = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+        d        = _mm256_add_ps(d, _mm256_mul_ps(dz, dz));
+
+        best = _mm256_min_ps(best, d);
+    }
+
+    // reduce the lanes
+    __m128 m = _mm_min_ps(_mm256_castps256_ps128(best),
+                          _mm256_extractf128_ps(best, 1));
+    m        = _mm_min_ps(m, _mm_movehl_ps(m, m));
+    m        = _mm_min_ss(m, _mm_shuffle_ps(m, m, 1));
+
+    return _mm_cvtss_f32(m);
+}
+
+__attribute__((target("avx512f"))) static float scan_avx512(float const* xs,
+                                                           float const* ys,
+                                                           float const* zs,
+                                                           size_t count,
+                                                           glm::vec3 q) {
+    __m512 qx   = _mm512_set1_ps(q.x);
+    __m512 qy   = _mm512_set1_ps(q.y);
+    __m512 qz   = _mm512_set1_ps(q.z);
+    __m512 best = _mm512_set1_ps(std::numeric_limits<float>::max());
+
+    for (size_t i = 0; i < count; i += 16) {
+        __m512 dx = _mm512_sub_ps(_mm512_loadu_ps(xs + i), qx);
+        __m512 dy = _mm512_sub_ps(_mm512_loadu_ps(ys + i), qy);
+        __m512 dz = _mm512_sub_ps(_mm512_loadu_ps(zs + i), qz);
+
+        __m512 d = _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+        d        = _mm512_add_ps(d, _mm512_mul_ps(dz, dz));
+
+        best = _mm512_min_ps(best, d);
+    }
+
+    return _mm512_reduce_min_ps(best);
+}
+
+#endif
+
+using ScanFunction = float (*)(float const*,
+                               float const*,
+                               float const*,
+                               size_t,
+                               glm::vec3);
+
+///
+/// \brief Pick the widest kernel this CPU can run. Done once.
+///
+static std::pair<ScanFunction, char const*> const& kernel() {
+    static std::pair<ScanFunction, char const*> const picked =
+        []() -> std::pair<ScanFunction, char const*> {
+#ifdef VASC_X86_KERNELS
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx512f")) return { scan_avx512, "avx512" };
+        if (__builtin_cpu_supports("avx2")) return { scan_avx2, "avx2" };
+#endif
+        return { scan_scalar, "scalar" };
+    }();
+
+    return picked;
+}
+
+float BorderPoints::min_squared_distance(glm::vec3 q) const {
+    if (m_count == 0) return std::numeric_limits<float>::max();
+
+    return kernel().first(m_x.data(), m_y.data(), m_z.data(), m_x.size(), q);
+}
+
+char const* BorderPoints::kernel_name() { return kernel().second; }
@@ -0,0 +1,41 @@
+#ifndef BORDER_POINTS_H
+#define BORDER_POINTS_H
+
+#include "glm_include.h"
+
+#include <vector>
+
+///
+/// \brief The BorderPoints class holds points in structure of arrays form,
+/// for fast nearest distance scans.
+///
+/// Coordinates are padded to a multiple of the widest vector width with
+/// points far from anything, so vector kernels never need a tail loop. On x86,
+/// the scan uses AVX-512 or AVX2 when the CPU supports it, picked at runtime;
+/// otherwise a scalar loop is used.
+///
+class BorderPoints {
+    std::vector<float> m_x;
+    std::vector<float> m_y;
+    std::vector<float> m_z;
+
+    size_t m_count = 0; ///< Number of points, without padding
+
+public:
+    explicit BorderPoints(std::vector<glm::vec3> const& points);
+
+    ///
+    /// \brief Get the squared distance from a query to the closest point.
+    ///
+    /// If there are no points, this is the max float.
+    ///
+    [[nodiscard]] float min_squared_distance(glm::vec3) const;
+
+    /// \brief Get the name of the kernel in use, for reporting
+    [[nodiscard]] static char const* kernel_name();
+
+    [[nodiscard]] size_t size() const { return m_count; }
+    [[nodiscard]] bool   empty() const { return m_count == 0; }
+};
+
+#endif // BORDER_POINTS_H
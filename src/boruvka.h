@@ -0,0 +1,157 @@
+#ifndef BORUVKA_H
+#define BORUVKA_H
+
+#include "disjointset.h"
+#include "jobcontroller.h"
+#include "simplegraph.h"
+#include "xrange.h"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <tuple>
+#include <vector>
+
+///
+/// \brief Compute a minimum spanning forest with Boruvka's algorithm, in
+/// parallel.
+///
+/// The graph is never stored; edges are produced on demand by a visitor. Each
+/// job calls make_visitor once, so a visitor may hold state that is not
+/// thread safe, like a grid accessor. A visitor has the signature
+/// (uint32_t node, F f) -> void, and calls f(uint32_t other, float weight)
+/// for each edge of the node. Edges must be reported from both ends, with
+/// the same weight.
+///
+/// Edges are ordered by weight, then by their node pair. This is the same
+/// order the CSR Kruskal engine uses, and as it is total, components can never
+/// pick edges that form a cycle.
+///
+/// \param node_count Number of nodes
+/// \param nodes_per_job Number of nodes each job of a parallel pass handles
+/// \param make_visitor Function, of signature () -> visitor
+///
+/// \return Forest, as an edge list of node indices
+///
+template <class MakeVisitor>
+std::vector<EdgeKey> boruvka_spanning_forest(size_t      node_count,
+                                             size_t      nodes_per_job,
+                                             MakeVisitor make_visitor) {
+    using Index = uint32_t;
+
+    constexpr Index NONE = std::numeric_limits<Index>::max();
+
+    size_t const n = node_count;
+
+    auto edge_less =
+        [](float wa, Index a0, Index a1, float wb, Index b0, Index b1) {
+            return std::make_tuple(wa, std::min(a0, a1), std::max(a0, a1)) <
+                   std::make_tuple(wb, std::min(b0, b1), std::max(b0, b1));
+        };
+
+    // component of each node, always pointing straight at the root
+    std::vector<Index> component(n);
+
+    ConcurrentDisjointSet sets(n);
+
+    std::vector<Index> roots(n);
+
+    for (size_t i : xrange(n)) {
+        component[i] = i;
+        roots[i]     = i;
+    }
+
+    // cheapest edge leaving each node, and each component
+    std::vector<Index>              best_neighbor(n);
+    std::vector<float>              best_weight(n);
+    std::vector<std::atomic<Index>> component_best(n);
+
+    std::vector<EdgeKey> ret;
+
+    while (roots.size() > 1) {
+        for (auto r : roots) {
+            component_best[r].store(NONE, std::memory_order_relaxed);
+        }
+
+        parallel_for(n, nodes_per_job, [&](size_t begin, size_t end) {
+            auto visit = make_visitor();
+
+            for (size_t i : xrange(begin, end)) {
+                Index node  = i;
+                Index best  = NONE;
+                float bestw = 0;
+
+                visit(node, [&](Index other, float w) {
+                    if (component[other] == component[i]) return;
+
+                    if (best == NONE or
+                        edge_less(w, node, other, bestw, node, best)) {
+                        best  = other;
+                        bestw = w;
+                    }
+                });
+
+                best_neighbor[i] = best;
+                best_weight[i]   = bestw;
+
+                if (best == NONE) continue;
+
+                // offer this edge to our component
+                auto& slot    = component_best[component[i]];
+                Index current = slot.load(std::memory_order_acquire);
+
+                while (current == NONE or
+                       edge_less(best_weight[i],
+                                 node,
+                                 best,
+                                 best_weight[current],
+                                 current,
+                                 best_neighbor[current])) {
+                    if (slot.compare_exchange_weak(current, node)) break;
+                }
+            }
+        });
+
+        // link components along their cheapest edges
+        std::vector<uint8_t> linked(roots.size(), 0);
+
+        parallel_for(
+            roots.size(), nodes_per_job, [&](size_t begin, size_t end) {
+                for (size_t ri : xrange(begin, end)) {
+                    Index node = component_best[roots[ri]].load(
+                        std::memory_order_relaxed);
+
+                    if (node == NONE) continue;
+
+                    // both components may have picked the same edge; only
+                    // one of them will link
+                    linked[ri] = sets.unite(node, best_neighbor[node]);
+                }
+            });
+
+        size_t const edges_before = ret.size();
+
+        for (size_t ri : xrange_over(roots)) {
+            if (!linked[ri]) continue;
+
+            Index node = component_best[roots[ri]].load();
+
+            ret.emplace_back(node, best_neighbor[node]);
+        }
+
+        // the remaining components are disconnected from each other
+        if (ret.size() == edges_before) break;
+
+        parallel_for(n, nodes_per_job, [&](size_t begin, size_t end) {
+            for (size_t i : xrange(begin, end)) {
+                component[i] = sets.find(i);
+            }
+        });
+
+        std::erase_if(roots, [&](Index r) { return component[r] != r; });
+    }
+
+    return ret;
+}
+
+#endif // BORUVKA_H
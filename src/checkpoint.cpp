@@ -0,0 +1,246 @@
+#include "checkpoint.h"
+
+#include "flow_graph_file.h"
+#include "global.h"
+#include "trace.h"
+
+#include <fmt/printf.h>
+
+#include <openvdb/io/File.h>
+
+#include <fstream>
+#include <type_traits>
+
+/// Bump when a change to the stages makes old checkpoints stale
+constexpr uint64_t CHECKPOINT_VERSION = 3;
+
+///
+/// \brief The KeyHash class builds a 64 bit FNV-1a hash of checkpoint inputs
+///
+class KeyHash {
+    uint64_t m_state = 0xcbf29ce484222325ULL;
+
+public:
+    void add(void const* data, size_t size) {
+        auto const* bytes = static_cast<unsigned char const*>(data);
+
+        for (size_t i = 0; i < size; i++) {
+            m_state ^= bytes[i];
+            m_state *= 0x100000001b3ULL;
+        }
+    }
+
+    template <class T>
+    void add(T const& value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        add(&value, sizeof(T));
+    }
+
+    void add_file(std::filesystem::path const& path) {
+        std::ifstream stream(path, std::ios::binary);
+
+        if (!stream.good()) {
+            fatal("Unable to read file for checkpoint key!");
+        }
+
+        std::vector<char> buffer(1 << 20);
+
+        while (stream) {
+            stream.read(buffer.data(), buffer.size());
+            add(buffer.data(), stream.gcount());
+        }
+    }
+
+    [[nodiscard]] std::string hex() const {
+        return fmt::format("{:016x}", m_state);
+    }
+};
+
+Checkpoints::Checkpoints(Configuration const& c) {
+    if (c.checkpoint_dir.empty()) return;
+
+    m_dir = c.checkpoint_dir;
+
+    KeyHash voxel_hash;
+    voxel_hash.add(CHECKPOINT_VERSION);
+    voxel_hash.add_file(c.mesh_path);
+    voxel_hash.add(c.cube_size);
+    voxel_hash.add(c.voxel_memory_budget > 0);
+    voxel_hash.add(c.mesh_combine);
+    voxel_hash.add(c.distance_engine == DistanceEngine::SDF);
+
+    m_voxel_key = voxel_hash.hex();
+
+    if (!c.seed) {
+        fmt::print("No seed set; flow graph will not be checkpointed\n");
+        return;
+    }
+
+    KeyHash graph_hash = voxel_hash;
+    graph_hash.add(*c.seed);
+    graph_hash.add(c.root_around.has_value());
+    graph_hash.add(c.root_around.value_or(glm::vec3(0)));
+    graph_hash.add(c.distance_engine);
+    graph_hash.add(c.graph_engine);
+    graph_hash.add(c.mst_engine);
+    graph_hash.add(c.multires_levels);
+
+    // with coarse levels, pruning decides which branches are refined
+    if (c.multires_levels > 0) graph_hash.add(c.prune_flow);
+
+    // the root is picked at its jittered position
+    if (c.root_around) graph_hash.add(c.position_randomness);
+
+    m_flow_graph_key = graph_hash.hex();
+}
+
+///
+/// \brief Write a file through a temporary, so an interrupted run never
+/// leaves a partial checkpoint under the final name.
+///
+template <class Function>
+static void write_atomically(std::filesystem::path const& path, Function f) {
+    std::filesystem::create_directories(path.parent_path());
+
+    auto temporary = path;
+    temporary += ".tmp";
+
+    f(temporary);
+
+    std::filesystem::rename(temporary, path);
+
+    fmt::print("Saved checkpoint {}\n", path.c_str());
+}
+
+// Voxels ======================================================================
+
+static char const* const INTERIOR_NAME = "interior";
+static char const* const DISTANCE_NAME = "distance";
+
+static openvdb::Vec3i to_vec3i(openvdb::Coord c) {
+    return { c.x(), c.y(), c.z() };
+}
+
+std::optional<VoxelResult> Checkpoints::load_voxels() const {
+    if (m_dir.empty()) return std::nullopt;
+
+    auto path = m_dir / ("voxels-" + m_voxel_key + ".vdb");
+
+    if (!std::filesystem::is_regular_file(path)) return std::nullopt;
+
+    TraceZone zone("load voxels");
+
+    try {
+        openvdb::io::File file(path.string());
+        file.open();
+
+        auto grid = openvdb::gridPtrCast<openvdb::MaskGrid>(
+            file.readGrid(INTERIOR_NAME));
+
+        openvdb::FloatGrid::Ptr distance;
+
+        if (file.hasGrid(DISTANCE_NAME)) {
+            distance = openvdb::gridPtrCast<openvdb::FloatGrid>(
+                file.readGrid(DISTANCE_NAME));
+        }
+
+        file.close();
+
+        if (!grid) return std::nullopt;
+
+        auto lo        = grid->metaValue<openvdb::Vec3i>("domain_min");
+        auto hi        = grid->metaValue<openvdb::Vec3i>("domain_max");
+        auto scale     = grid->metaValue<openvdb::Vec3s>("transform_scale");
+        auto translate = grid->metaValue<openvdb::Vec3s>("transform_translate");
+
+        fmt::print("Loaded checkpoint {}\n", path.c_str());
+
+        return VoxelResult {
+            grid,
+            openvdb::CoordBBox(lo.x(), lo.y(), lo.z(), hi.x(), hi.y(), hi.z()),
+            distance,
+            SimpleTransform(glm::vec3(scale.x(), scale.y(), scale.z()),
+                            glm::vec3(
+                                translate.x(), translate.y(), translate.z())),
+        };
+    } catch (openvdb::Exception const& e) {
+        fmt::print("Ignoring unreadable checkpoint {}: {}\n",
+                   path.c_str(),
+                   e.what());
+    }
+
+    return std::nullopt;
+}
+
+void Checkpoints::save_voxels(VoxelResult const& result) const {
+    if (m_dir.empty()) return;
+
+    TraceZone zone("save voxels");
+
+    // metadata is stored on the grid, so write a shallow copy of it
+    auto grid = result.interior->copy();
+
+    auto scale     = result.tf.scale();
+    auto translate = result.tf.translate();
+
+    grid->setName(INTERIOR_NAME);
+    grid->insertMeta("domain_min",
+                     openvdb::Vec3IMetadata(to_vec3i(result.domain.min())));
+    grid->insertMeta("domain_max",
+                     openvdb::Vec3IMetadata(to_vec3i(result.domain.max())));
+    grid->insertMeta(
+        "transform_scale",
+        openvdb::Vec3SMetadata(openvdb::Vec3s(scale.x, scale.y, scale.z)));
+    grid->insertMeta("transform_translate",
+                     openvdb::Vec3SMetadata(openvdb::Vec3s(
+                         translate.x, translate.y, translate.z)));
+
+    openvdb::GridPtrVec grids { grid };
+
+    if (result.distance) {
+        auto distance = result.distance->copy();
+        distance->setName(DISTANCE_NAME);
+        grids.push_back(distance);
+    }
+
+    write_atomically(m_dir / ("voxels-" + m_voxel_key + ".vdb"),
+                     [&](std::filesystem::path const& path) {
+                         openvdb::io::File file(path.string());
+                         file.write(grids);
+                         file.close();
+                     });
+}
+
+// Flow Graph ==================================================================
+
+std::optional<SimpleGraph> Checkpoints::load_flow_graph() const {
+    if (!m_flow_graph_key) return std::nullopt;
+
+    auto path = m_dir / ("flow_graph-" + *m_flow_graph_key + ".bin");
+
+    if (!std::filesystem::is_regular_file(path)) return std::nullopt;
+
+    TraceZone zone("load flow graph");
+
+    auto mapped = MappedFlowGraph::map(path);
+
+    if (!mapped) {
+        fmt::print("Ignoring unreadable checkpoint {}\n", path.c_str());
+        return std::nullopt;
+    }
+
+    fmt::print("Loaded checkpoint {}\n", path.c_str());
+
+    return mapped->to_simple_graph();
+}
+
+void Checkpoints::save_flow_graph(SimpleGraph const& G) const {
+    if (!m_flow_graph_key) return;
+
+    TraceZone zone("save flow graph");
+
+    write_atomically(m_dir / ("flow_graph-" + *m_flow_graph_key + ".bin"),
+                     [&](std::filesystem::path const& path) {
+                         write_flow_graph(path, G);
+                     });
+}
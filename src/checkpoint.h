@@ -0,0 +1,47 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "simplegraph.h"
+#include "voxelmesh.h"
+
+#include <filesystem>
+#include <optional>
+#include <string>
+
+struct Configuration;
+
+///
+/// \brief The Checkpoints class saves and restores the results of the
+/// expensive pipeline stages, so reruns that only change later options can
+/// skip them.
+///
+/// Each checkpoint lives in the checkpoint directory under a name holding a
+/// hash of everything its stage depends on. The voxel grid is keyed by the
+/// mesh file contents and voxel size. The flow graph is keyed by the voxel
+/// key, the seed, and the options that shape the graph; it is only saved
+/// when the seed is fixed, as a drawn seed never repeats. Pruning, relaxing
+/// and jitter happen after the flow graph, so their options are not part of
+/// any key.
+///
+/// If no checkpoint directory is configured, nothing is loaded or saved.
+///
+class Checkpoints {
+    std::filesystem::path      m_dir;
+    std::string                m_voxel_key;
+    std::optional<std::string> m_flow_graph_key;
+
+public:
+    explicit Checkpoints(Configuration const&);
+
+    /// \brief Get the voxel grid and transform, if a matching one was saved
+    [[nodiscard]] std::optional<VoxelResult> load_voxels() const;
+
+    void save_voxels(VoxelResult const&) const;
+
+    /// \brief Get the flow graph, if a matching one was saved
+    [[nodiscard]] std::optional<SimpleGraph> load_flow_graph() const;
+
+    void save_flow_graph(SimpleGraph const&) const;
+};
+
+#endif // CHECKPOINT_H
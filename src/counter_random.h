@@ -0,0 +1,46 @@
+#ifndef COUNTER_RANDOM_H
+#define COUNTER_RANDOM_H
+
+#include <cstdint>
+
+///
+/// \brief The CounterRandom class is a stateless, counter based random
+/// source.
+///
+/// Each value is a pure function of the seed, a key (like a node id) and a
+/// stream number, mixed with the splitmix64 finalizer. There is no state to
+/// share, so any number of threads may draw values at once, and the values
+/// do not depend on the order of the draws.
+///
+class CounterRandom {
+    uint64_t m_seed;
+
+    static uint64_t mix(uint64_t z) {
+        z += 0x9e3779b97f4a7c15ULL;
+        z = (z ^ (z >> 30U)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27U)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31U);
+    }
+
+public:
+    explicit CounterRandom(uint64_t seed) : m_seed(mix(seed)) {}
+
+    /// \brief Get 64 random bits for a key, from a given stream
+    [[nodiscard]] uint64_t bits(uint64_t key, uint64_t stream) const {
+        return mix(mix(m_seed ^ key) ^ stream);
+    }
+
+    /// \brief Get a uniform value in [0, 1) for a key, from a given stream
+    [[nodiscard]] float uniform(uint64_t key, uint64_t stream) const {
+        // the top 24 bits fill a float mantissa exactly
+        return static_cast<float>(bits(key, stream) >> 40U) * 0x1.0p-24F;
+    }
+
+    /// \brief Get a uniform value in [lo, hi) for a key, from a given stream
+    [[nodiscard]] float
+    uniform(uint64_t key, uint64_t stream, float lo, float hi) const {
+        return lo + (hi - lo) * uniform(key, stream);
+    }
+};
+
+#endif // COUNTER_RANDOM_H
@@ -0,0 +1,329 @@
+#include "csrgraph.h"
+
+#include "boruvka.h"
+#include "disjointset.h"
+#include "global.h"
+#include "jobcontroller.h"
+#include "memory_report.h"
+#include "trace.h"
+#include "xrange.h"
+
+#include <fmt/printf.h>
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <tuple>
+
+CSRGraph::CSRGraph() = default;
+
+CSRGraph::~CSRGraph() = default;
+
+size_t CSRGraph::add_node(int64_t id, NodeData nd) {
+    assert(!has_topology());
+
+    if (m_ids.size() >= std::numeric_limits<Index>::max()) {
+        fatal("Too many nodes for graph!");
+    }
+
+    m_ids.push_back(id);
+    m_data.push_back(nd);
+
+    return m_ids.size() - 1;
+}
+
+void CSRGraph::reserve(size_t count) {
+    m_ids.reserve(count);
+    m_data.reserve(count);
+}
+
+void CSRGraph::set_topology(std::vector<size_t>&& offsets,
+                            std::vector<Index>&&  neighbors,
+                            std::vector<float>&&  weights) {
+    if (offsets.size() != node_count() + 1 or
+        offsets.back() != neighbors.size() or
+        neighbors.size() != weights.size()) {
+        fatal("Inconsistent graph topology!");
+    }
+
+    m_offsets   = std::move(offsets);
+    m_neighbors = std::move(neighbors);
+    m_weights   = std::move(weights);
+}
+
+size_t CSRGraph::memory_usage() const {
+    return vector_bytes(m_ids) + vector_bytes(m_data) +
+           vector_bytes(m_offsets) + vector_bytes(m_neighbors) +
+           vector_bytes(m_weights);
+}
+
+CSRGraph::Neighbors CSRGraph::neighbors(size_t i) const {
+    assert(has_topology());
+
+    auto b = m_offsets[i];
+    auto e = m_offsets[i + 1];
+
+    return { m_neighbors.data() + b,
+             m_neighbors.data() + e,
+             m_weights.data() + b };
+}
+
+/// Number of nodes each job of a parallel pass handles
+constexpr size_t NODES_PER_JOB = 1 << 14;
+
+/// Marks a node that does not survive compaction
+constexpr CSRGraph::Index REMOVED = std::numeric_limits<CSRGraph::Index>::max();
+
+std::vector<EdgeKey>
+CSRGraph::compute_min_spanning_tree(MSTEngine engine) const {
+    TraceZone zone("mst");
+
+    auto ret = (engine == MSTEngine::BORUVKA) ? boruvka_spanning_tree()
+                                              : kruskal_spanning_tree();
+
+    // for nodes a - b - c, edge count 2, node count 3
+
+    if ((ret.size() + 1) != node_count()) {
+        fmt::print("Mismatch size {} {}\n", ret.size(), node_count());
+        fatal("Unable to continue");
+    }
+
+    return ret;
+}
+
+std::vector<EdgeKey> CSRGraph::kruskal_spanning_tree() const {
+    struct WeightedEdge {
+        Index a;
+        Index b;
+        float weight;
+    };
+
+    std::vector<WeightedEdge> edge_list;
+    edge_list.reserve(edge_count());
+
+    // each edge is stored twice; only take the copy from the lower index
+    for (size_t i : xrange(node_count())) {
+        auto adj = neighbors(i);
+
+        for (size_t k : xrange(adj.size())) {
+            auto other = adj.first[k];
+
+            if (other <= i) continue;
+
+            edge_list.push_back(
+                { static_cast<Index>(i), other, adj.weight(k) });
+        }
+    }
+
+    // break ties on the node pair so the result does not depend on the sort
+    std::sort(edge_list.begin(),
+              edge_list.end(),
+              [](auto const& a, auto const& b) {
+                  return std::tie(a.weight, a.a, a.b) <
+                         std::tie(b.weight, b.a, b.b);
+              });
+
+    DisjointSet sets(node_count());
+
+    std::vector<EdgeKey> ret;
+
+    for (auto const& e : edge_list) {
+        if (sets.unite(e.a, e.b)) {
+            ret.emplace_back(e.a, e.b);
+        }
+    }
+
+    return ret;
+}
+
+std::vector<EdgeKey> CSRGraph::boruvka_spanning_tree() const {
+    auto make_visitor = [this]() {
+        return [this](Index node, auto&& f) {
+            auto adj = neighbors(node);
+
+            for (size_t k : xrange(adj.size())) {
+                f(adj.first[k], adj.weight(k));
+            }
+        };
+    };
+
+    return boruvka_spanning_forest(node_count(), NODES_PER_JOB, make_visitor);
+}
+
+///
+/// \brief Number the elements of a range that pass a predicate, in order, in
+/// parallel.
+///
+/// \param count Number of elements
+/// \param pass Function, of signature (size_t) -> bool
+/// \param none Number given to elements that fail
+///
+/// \return The number of each element, and the number of elements that pass
+///
+template <class Predicate>
+static std::pair<std::vector<CSRGraph::Index>, size_t>
+number_passing(size_t count, Predicate pass, CSRGraph::Index none) {
+    size_t const chunks = (count + NODES_PER_JOB - 1) / NODES_PER_JOB;
+
+    std::vector<size_t> chunk_start(chunks + 1, 0);
+
+    parallel_for(count, NODES_PER_JOB, [&](size_t begin, size_t end) {
+        size_t passed = 0;
+
+        for (size_t i : xrange(begin, end)) {
+            if (pass(i)) passed++;
+        }
+
+        chunk_start[begin / NODES_PER_JOB + 1] = passed;
+    });
+
+    for (size_t c : xrange(chunks)) {
+        chunk_start[c + 1] += chunk_start[c];
+    }
+
+    std::vector<CSRGraph::Index> numbers(count);
+
+    parallel_for(count, NODES_PER_JOB, [&](size_t begin, size_t end) {
+        size_t next = chunk_start[begin / NODES_PER_JOB];
+
+        for (size_t i : xrange(begin, end)) {
+            numbers[i] = pass(i) ? next++ : none;
+        }
+    });
+
+    return { std::move(numbers), chunk_start.back() };
+}
+
+CSRGraph::Components CSRGraph::components() const {
+    size_t const n = node_count();
+
+    ConcurrentDisjointSet sets(n);
+
+    parallel_for(n, NODES_PER_JOB, [&](size_t begin, size_t end) {
+        for (size_t i : xrange(begin, end)) {
+            for (auto other : neighbors(i)) {
+                if (other > i) sets.unite(i, other);
+            }
+        }
+    });
+
+    // roots are always the lowest index of their set, so numbering the roots
+    // in order numbers components in order of their first node
+    std::vector<Index> root(n);
+
+    parallel_for(n, NODES_PER_JOB, [&](size_t begin, size_t end) {
+        for (size_t i : xrange(begin, end)) {
+            root[i] = sets.find(i);
+        }
+    });
+
+    auto [root_label, component_count] = number_passing(
+        n,
+        [&root](size_t i) { return root[i] == i; },
+        std::numeric_limits<Index>::max());
+
+    Components ret;
+    ret.labels.resize(n);
+
+    parallel_for(n, NODES_PER_JOB, [&](size_t begin, size_t end) {
+        for (size_t i : xrange(begin, end)) {
+            ret.labels[i] = root_label[root[i]];
+        }
+    });
+
+    ret.sizes.resize(component_count);
+
+    for (auto label : ret.labels) {
+        ret.sizes[label]++;
+    }
+
+    return ret;
+}
+
+CSRGraph CSRGraph::filtered(std::vector<bool> const& keep) const {
+    assert(keep.size() == node_count());
+
+    auto [remap, kept] = number_passing(
+        node_count(), [&keep](size_t i) { return keep[i]; }, REMOVED);
+
+    return compacted(remap, kept);
+}
+
+CSRGraph CSRGraph::component(Components const& components,
+                             size_t            label) const {
+    assert(components.labels.size() == node_count());
+
+    auto [remap, kept] = number_passing(
+        node_count(),
+        [&](size_t i) { return components.labels[i] == label; },
+        REMOVED);
+
+    return compacted(remap, kept);
+}
+
+CSRGraph CSRGraph::compacted(std::vector<Index> const& remap,
+                             size_t                    kept) const {
+    CSRGraph ret;
+
+    ret.m_ids.resize(kept);
+    ret.m_data.resize(kept);
+
+    parallel_for(node_count(), NODES_PER_JOB, [&](size_t begin, size_t end) {
+        for (size_t i : xrange(begin, end)) {
+            if (remap[i] == REMOVED) continue;
+
+            ret.m_ids[remap[i]]  = m_ids[i];
+            ret.m_data[remap[i]] = m_data[i];
+        }
+    });
+
+    if (!has_topology()) return ret;
+
+    // count surviving neighbors, then sum into offsets
+    std::vector<size_t> offsets(kept + 1, 0);
+
+    parallel_for(node_count(), NODES_PER_JOB, [&](size_t begin, size_t end) {
+        for (size_t i : xrange(begin, end)) {
+            if (remap[i] == REMOVED) continue;
+
+            size_t count = 0;
+
+            for (auto other : neighbors(i)) {
+                if (remap[other] != REMOVED) count++;
+            }
+
+            offsets[remap[i] + 1] = count;
+        }
+    });
+
+    for (size_t i : xrange(kept)) {
+        offsets[i + 1] += offsets[i];
+    }
+
+    std::vector<Index> neighbor_list(offsets.back());
+    std::vector<float> weights(offsets.back());
+
+    parallel_for(node_count(), NODES_PER_JOB, [&](size_t begin, size_t end) {
+        for (size_t i : xrange(begin, end)) {
+            if (remap[i] == REMOVED) continue;
+
+            auto   adj  = neighbors(i);
+            size_t slot = offsets[remap[i]];
+
+            for (size_t k : xrange(adj.size())) {
+                auto other = remap[adj.first[k]];
+
+                if (other == REMOVED) continue;
+
+                neighbor_list[slot] = other;
+                weights[slot]       = adj.weight(k);
+                slot++;
+            }
+        }
+    });
+
+    ret.set_topology(
+        std::move(offsets), std::move(neighbor_list), std::move(weights));
+
+    return ret;
+}
@@ -0,0 +1,157 @@
+#ifndef CSRGRAPH_H
+#define CSRGRAPH_H
+
+#include "global.h"
+#include "simplegraph.h"
+
+#include <cstdint>
+#include <vector>
+
+///
+/// \brief The CSRGraph class is a compact undirected graph, stored in
+/// compressed sparse row form.
+///
+/// Nodes are addressed by dense indices, in the order they were added, and
+/// each carries an external id (for example, a voxel cell id). Node data is
+/// held in a contiguous per-node array.
+///
+/// Topology is set in one step, once all nodes are known. Each undirected
+/// edge appears in the neighbor lists of both of its nodes, with the same
+/// weight.
+///
+class CSRGraph {
+public:
+    using Index = uint32_t;
+
+    ///
+    /// \brief The Neighbors struct is a view of the adjacency of a node
+    ///
+    struct Neighbors {
+        Index const* first   = nullptr;
+        Index const* last    = nullptr;
+        float const* weights = nullptr;
+
+        [[nodiscard]] Index const* begin() const { return first; }
+        [[nodiscard]] Index const* end() const { return last; }
+        [[nodiscard]] size_t       size() const { return last - first; }
+
+        /// \brief Get the weight of the i'th neighbor
+        [[nodiscard]] float weight(size_t i) const { return weights[i]; }
+    };
+
+    ///
+    /// \brief The Components struct is a labelling of connected components
+    ///
+    struct Components {
+        std::vector<Index>  labels; ///< Component of each node
+        std::vector<size_t> sizes;  ///< Node count of each component
+    };
+
+private:
+    std::vector<int64_t>  m_ids;
+    std::vector<NodeData> m_data;
+
+    std::vector<size_t> m_offsets; ///< Empty until topology is set
+    std::vector<Index>  m_neighbors;
+    std::vector<float>  m_weights;
+
+    [[nodiscard]] std::vector<EdgeKey> kruskal_spanning_tree() const;
+    [[nodiscard]] std::vector<EdgeKey> boruvka_spanning_tree() const;
+
+    ///
+    /// \brief Build a new graph from a subset of nodes
+    /// \param remap New index of each node, or REMOVED
+    /// \param kept Number of nodes that are not removed
+    ///
+    [[nodiscard]] CSRGraph compacted(std::vector<Index> const& remap,
+                                     size_t                    kept) const;
+
+public:
+    CSRGraph();
+    ~CSRGraph();
+
+    CSRGraph(CSRGraph&&) = default;
+    CSRGraph& operator=(CSRGraph&&) = default;
+
+    ///
+    /// \brief Add a node to the graph, returns the index of the node.
+    ///
+    /// Nodes cannot be added after topology is set.
+    ///
+    size_t add_node(int64_t id, NodeData);
+
+    /// \brief Reserve space for a number of nodes
+    void reserve(size_t);
+
+    ///
+    /// \brief Set the topology of the graph
+    ///
+    /// \param offsets Start of each node's neighbor list, plus one past the
+    /// end of the last list
+    /// \param neighbors Concatenated neighbor lists
+    /// \param weights Weight for each entry in the neighbor lists
+    ///
+    void set_topology(std::vector<size_t>&& offsets,
+                      std::vector<Index>&&  neighbors,
+                      std::vector<float>&&  weights);
+
+    /// \brief Ask if topology has been set
+    [[nodiscard]] bool has_topology() const { return !m_offsets.empty(); }
+
+    /// \brief Get the number of nodes
+    [[nodiscard]] size_t node_count() const { return m_ids.size(); }
+
+    /// \brief Get the number of undirected edges
+    [[nodiscard]] size_t edge_count() const { return m_neighbors.size() / 2; }
+
+    /// \brief Get the bytes held by the graph's arrays
+    [[nodiscard]] size_t memory_usage() const;
+
+    /// \brief Get the external id of a node
+    [[nodiscard]] int64_t id(size_t i) const { return m_ids[i]; }
+
+    ///@{
+    /// Get the user data for a given node.
+    [[nodiscard]] NodeData const& node(size_t i) const { return m_data[i]; }
+    [[nodiscard]] NodeData&       node(size_t i) { return m_data[i]; }
+    ///@}
+
+    ///@{
+    /// Get the user data for all nodes, in index order.
+    [[nodiscard]] auto&       node_data() { return m_data; }
+    [[nodiscard]] auto const& node_data() const { return m_data; }
+    ///@}
+
+    /// \brief Get the neighbors of a node. Topology must be set.
+    [[nodiscard]] Neighbors neighbors(size_t i) const;
+
+    ///
+    /// \brief Compute a minimum spanning tree, returns an edge list of node
+    /// indices
+    ///
+    /// Both engines order edges identically, so give the same tree. Kruskal
+    /// is serial; Boruvka works on all components at once, in parallel.
+    ///
+    [[nodiscard]] std::vector<EdgeKey>
+    compute_min_spanning_tree(MSTEngine = MSTEngine::KRUSKAL) const;
+
+    ///
+    /// \brief Get connected components. Components are numbered in order of
+    /// their first node.
+    ///
+    [[nodiscard]] Components components() const;
+
+    ///
+    /// \brief Build a new graph with only the flagged nodes, and the edges
+    /// between them. Node order is preserved.
+    ///
+    [[nodiscard]] CSRGraph filtered(std::vector<bool> const& keep) const;
+
+    ///
+    /// \brief Build a new graph with only the nodes of one component. Node
+    /// order is preserved.
+    ///
+    [[nodiscard]] CSRGraph component(Components const&, size_t label) const;
+};
+
+#endif // CSRGRAPH_H
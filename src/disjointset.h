@@ -0,0 +1,135 @@
+#ifndef DISJOINTSET_H
+#define DISJOINTSET_H
+
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+///
+/// \brief The DisjointSet class is a dense, index based union-find structure.
+///
+/// Elements are the indices [0, size). Sets are merged by size, and lookups
+/// halve the path as they go, so no lookup allocates. Not thread safe; see
+/// ConcurrentDisjointSet for that.
+///
+class DisjointSet {
+public:
+    using Index = uint32_t;
+
+private:
+    std::vector<Index> m_parents;
+    std::vector<Index> m_sizes;
+
+public:
+    /// \brief Create a structure where every element is in its own set
+    explicit DisjointSet(size_t count) : m_parents(count), m_sizes(count, 1) {
+        for (size_t i = 0; i < count; ++i) {
+            m_parents[i] = static_cast<Index>(i);
+        }
+    }
+
+    /// \brief Get the number of elements
+    [[nodiscard]] size_t size() const { return m_parents.size(); }
+
+    /// \brief Find the representative of the set an element is in
+    [[nodiscard]] Index find(Index i) {
+        while (m_parents[i] != i) {
+            m_parents[i] = m_parents[m_parents[i]];
+            i            = m_parents[i];
+        }
+        return i;
+    }
+
+    ///
+    /// \brief Merge the sets of two elements
+    /// \return True if the elements were in different sets
+    ///
+    bool unite(Index a, Index b) {
+        a = find(a);
+        b = find(b);
+
+        if (a == b) return false;
+
+        if (m_sizes[a] < m_sizes[b]) std::swap(a, b);
+
+        m_parents[b] = a;
+        m_sizes[a] += m_sizes[b];
+
+        return true;
+    }
+
+    /// \brief Get the element count of a set, from its representative
+    [[nodiscard]] size_t set_size(Index root) const { return m_sizes[root]; }
+};
+
+///
+/// \brief The ConcurrentDisjointSet class is a lock-free union-find structure.
+///
+/// Any number of threads may find and unite at once. Roots are linked with an
+/// atomic compare and swap, always under the root with the lower index, so the
+/// structure can never form a cycle. Lookups halve paths with a compare and
+/// swap; a lost race there is harmless.
+///
+class ConcurrentDisjointSet {
+public:
+    using Index = uint32_t;
+
+private:
+    std::vector<std::atomic<Index>> m_parents;
+
+public:
+    /// \brief Create a structure where every element is in its own set
+    explicit ConcurrentDisjointSet(size_t count) : m_parents(count) {
+        for (size_t i = 0; i < count; ++i) {
+            m_parents[i].store(static_cast<Index>(i),
+                               std::memory_order_relaxed);
+        }
+    }
+
+    /// \brief Get the number of elements
+    [[nodiscard]] size_t size() const { return m_parents.size(); }
+
+    /// \brief Find the representative of the set an element is in
+    [[nodiscard]] Index find(Index i) {
+        while (true) {
+            Index parent = m_parents[i].load(std::memory_order_acquire);
+
+            if (parent == i) return i;
+
+            Index grandparent =
+                m_parents[parent].load(std::memory_order_acquire);
+
+            if (grandparent != parent) {
+                m_parents[i].compare_exchange_weak(
+                    parent, grandparent, std::memory_order_acq_rel);
+            }
+
+            i = grandparent;
+        }
+    }
+
+    ///
+    /// \brief Merge the sets of two elements
+    /// \return True if this call merged the sets
+    ///
+    bool unite(Index a, Index b) {
+        while (true) {
+            a = find(a);
+            b = find(b);
+
+            if (a == b) return false;
+
+            if (a < b) std::swap(a, b);
+
+            // a may have been linked by another thread; if so, retry
+            Index expected = a;
+            if (m_parents[a].compare_exchange_strong(
+                    expected, b, std::memory_order_acq_rel)) {
+                return true;
+            }
+        }
+    }
+};
+
+#endif // DISJOINTSET_H
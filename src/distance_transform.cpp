@@ -0,0 +1,165 @@
+#include "distance_transform.h"
+
+#include "jobcontroller.h"
+#include "xrange.h"
+
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+/// Roughly how many voxels a single job should process
+constexpr int64_t VOXELS_PER_JOB = 1 << 16;
+
+///
+/// \brief Scratch space for transforming a line, reused between lines
+///
+struct LineScratch {
+    std::vector<int64_t> locations; ///< Parabola locations in the envelope
+    std::vector<double>  heights;   ///< Parabola heights in the envelope
+    std::vector<double>  bounds;    ///< Lower bound of each parabola
+
+    explicit LineScratch(int64_t n) : locations(n), heights(n), bounds(n) {}
+};
+
+///
+/// \brief Compute a 1D squared distance transform of a line, in place.
+///
+/// This builds the lower envelope of the parabolas rooted at each sample.
+/// Infinite samples (no seed yet) do not contribute a parabola; if all samples
+/// are infinite, the line is left untouched.
+///
+/// \param data Start of the line
+/// \param n Number of samples in the line
+/// \param stride Distance between samples
+///
+static void
+transform_line(float* data, int64_t n, int64_t stride, LineScratch& scratch) {
+    auto& v = scratch.locations;
+    auto& f = scratch.heights;
+    auto& z = scratch.bounds;
+
+    int64_t k = -1;
+
+    for (int64_t q : xrange(n)) {
+        double fq = data[q * stride];
+
+        if (!std::isfinite(fq)) continue;
+
+        double s = -std::numeric_limits<double>::infinity();
+
+        // pop parabolas that are hidden by this one. The first parabola has
+        // an unbounded lower bound, so is never popped.
+        while (k >= 0) {
+            s = ((fq + double(q * q)) - (f[k] + double(v[k] * v[k]))) /
+                double(2 * (q - v[k]));
+
+            if (s > z[k]) break;
+
+            k--;
+        }
+
+        k++;
+
+        v[k] = q;
+        f[k] = fq;
+        z[k] = (k == 0) ? -std::numeric_limits<double>::infinity() : s;
+    }
+
+    if (k < 0) return;
+
+    int64_t j = 0;
+
+    for (int64_t q : xrange(n)) {
+        while (j < k and z[j + 1] < double(q)) {
+            j++;
+        }
+
+        double d = double((q - v[j]) * (q - v[j])) + f[j];
+
+        data[q * stride] = static_cast<float>(d);
+    }
+}
+
+///
+/// \brief Transform all lines along an axis in parallel
+/// \param line_count Number of lines
+/// \param n Samples in each line
+/// \param stride Distance between samples in a line
+/// \param line_start Function of signature (size_t line) -> int64_t, giving
+/// the offset of the first sample of a line
+///
+template <class Function>
+static void transform_axis(std::vector<float>& data,
+                           int64_t             line_count,
+                           int64_t             n,
+                           int64_t             stride,
+                           Function            line_start) {
+
+    size_t grain =
+        std::max<int64_t>(1, VOXELS_PER_JOB / std::max<int64_t>(n, 1));
+
+    parallel_for(line_count, grain, [&](size_t begin, size_t end) {
+        LineScratch scratch(n);
+
+        for (size_t line : xrange(begin, end)) {
+            transform_line(data.data() + line_start(line), n, stride, scratch);
+        }
+    });
+}
+
+DistanceTransform::DistanceTransform(openvdb::CoordBBox const&     box,
+                                     std::vector<glm::vec3> const& seeds)
+    : m_box(box) {
+
+    auto dim = box.dim();
+
+    m_dims = glm::i64vec3(dim.x(), dim.y(), dim.z());
+
+    int64_t const nx = m_dims.x;
+    int64_t const ny = m_dims.y;
+    int64_t const nz = m_dims.z;
+
+    m_distances.resize(nx * ny * nz, std::numeric_limits<float>::infinity());
+
+    for (auto const& seed : seeds) {
+        glm::ivec3 p(seed);
+
+        if (!m_box.isInside({ p.x, p.y, p.z })) continue;
+
+        m_distances[offset_of(p)] = 0;
+    }
+
+    // x lines are contiguous
+    transform_axis(m_distances, ny * nz, nx, 1, [nx](int64_t line) {
+        return line * nx;
+    });
+
+    // y lines, one for each x, z
+    transform_axis(m_distances, nx * nz, ny, nx, [nx, ny](int64_t line) {
+        return (line % nx) + nx * ny * (line / nx);
+    });
+
+    // z lines, one for each x, y
+    transform_axis(
+        m_distances, nx * ny, nz, nx * ny, [](int64_t line) { return line; });
+}
+
+int64_t DistanceTransform::offset_of(glm::ivec3 p) const {
+    auto const& l = m_box.min();
+
+    int64_t x = p.x - l.x();
+    int64_t y = p.y - l.y();
+    int64_t z = p.z - l.z();
+
+    return x + m_dims.x * (y + m_dims.y * z);
+}
+
+float DistanceTransform::squared_distance(glm::ivec3 p) const {
+    assert(m_box.isInside({ p.x, p.y, p.z }));
+
+    float d = m_distances[offset_of(p)];
+
+    if (std::isinf(d)) return std::numeric_limits<float>::max();
+
+    return d;
+}
@@ -0,0 +1,47 @@
+#ifndef DISTANCE_TRANSFORM_H
+#define DISTANCE_TRANSFORM_H
+
+#include "glm_include.h"
+
+#include <openvdb/openvdb.h>
+
+#include <vector>
+
+///
+/// \brief The DistanceTransform class holds an exact squared Euclidean
+/// distance transform over a box of voxels.
+///
+/// Distances are measured, in voxels, from each voxel of the box to the
+/// nearest seed voxel. The transform is separable, and computed one axis at a
+/// time (Felzenszwalb and Huttenlocher), with the lines of each axis split
+/// between threads. Storage is dense over the whole box, whatever the number
+/// of seeds or queries.
+///
+class DistanceTransform {
+    openvdb::CoordBBox m_box;
+    glm::i64vec3       m_dims;
+
+    std::vector<float> m_distances;
+
+    [[nodiscard]] int64_t offset_of(glm::ivec3) const;
+
+public:
+    ///
+    /// \brief Compute the transform over a box
+    /// \param box Voxels to compute distances for
+    /// \param seeds Voxel coordinates to measure distance to. Seeds outside
+    /// the box are ignored.
+    ///
+    DistanceTransform(openvdb::CoordBBox const&     box,
+                      std::vector<glm::vec3> const& seeds);
+
+    ///
+    /// \brief Get the squared distance from a voxel to the nearest seed.
+    ///
+    /// If there are no seeds, this is the max float. The voxel must be inside
+    /// the box.
+    ///
+    [[nodiscard]] float squared_distance(glm::ivec3) const;
+};
+
+#endif // DISTANCE_TRANSFORM_H
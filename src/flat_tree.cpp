@@ -0,0 +1,89 @@
+#include "flat_tree.h"
+
+#include "global.h"
+#include "memory_report.h"
+#include "trace.h"
+
+#include <fmt/printf.h>
+
+FlatTree::FlatTree(std::vector<EdgeKey> const& edges,
+                   size_t                      node_count,
+                   Index                       root) {
+
+    TraceZone zone("tree");
+
+    if (node_count >= NONE or root >= node_count) {
+        fatal("Invalid tree root or size!");
+    }
+
+    // undirected adjacency of the tree, in compressed form
+    std::vector<size_t> offsets(node_count + 1, 0);
+
+    for (auto const& e : edges) {
+        offsets[e.a + 1]++;
+        offsets[e.b + 1]++;
+    }
+
+    for (size_t i : xrange(node_count)) {
+        offsets[i + 1] += offsets[i];
+    }
+
+    std::vector<Index> adjacent(offsets.back());
+
+    {
+        std::vector<size_t> slot(offsets.begin(), offsets.end() - 1);
+
+        for (auto const& e : edges) {
+            adjacent[slot[e.a]++] = e.b;
+            adjacent[slot[e.b]++] = e.a;
+        }
+    }
+
+    // breadth first from the root; the node list doubles as the queue
+    std::vector<Index> position_of(node_count, NONE);
+
+    m_nodes.reserve(edges.size() + 1);
+    m_parents.reserve(edges.size() + 1);
+    m_first_child.reserve(edges.size() + 2);
+
+    m_nodes.push_back(root);
+    m_parents.push_back(NONE);
+    position_of[root] = 0;
+
+    for (size_t pos = 0; pos < m_nodes.size(); ++pos) {
+        auto node = m_nodes[pos];
+
+        m_first_child.push_back(m_nodes.size());
+
+        for (auto k : xrange(offsets[node], offsets[node + 1])) {
+            auto other = adjacent[k];
+
+            if (position_of[other] != NONE) continue;
+
+            position_of[other] = m_nodes.size();
+            m_nodes.push_back(other);
+            m_parents.push_back(pos);
+        }
+    }
+
+    m_first_child.push_back(m_nodes.size());
+
+    // a tree with e edges has e + 1 nodes, all reachable from the root
+    if (m_nodes.size() != edges.size() + 1) {
+        fmt::print("Tree mismatch {} {}\n", m_nodes.size(), edges.size());
+        fatal("Edge list is not a tree!");
+    }
+
+    // each level holds the children of the one before, so it ends at the
+    // first child of the node just past the level before
+    m_first_level = { 0, 1 };
+
+    while (m_first_level.back() < m_nodes.size()) {
+        m_first_level.push_back(m_first_child[m_first_level.back()]);
+    }
+}
+
+size_t FlatTree::memory_usage() const {
+    return vector_bytes(m_nodes) + vector_bytes(m_parents) +
+           vector_bytes(m_first_child) + vector_bytes(m_first_level);
+}
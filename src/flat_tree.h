@@ -0,0 +1,85 @@
+#ifndef FLAT_TREE_H
+#define FLAT_TREE_H
+
+#include "simplegraph.h"
+#include "xrange.h"
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+///
+/// \brief The FlatTree class is a rooted tree, stored in breadth first order.
+///
+/// Nodes are addressed by their position in that order; the root is at
+/// position 0, and every parent comes before its children. As a result, the
+/// children of a node are a contiguous range of positions, and the children
+/// of consecutive nodes are consecutive ranges. A bottom up pass is a
+/// reverse scan, and a top down pass a forward scan.
+///
+/// Nodes at the same depth (a level) are also a contiguous range. Nodes of a
+/// level only depend on the levels next to it, so a level can be processed in
+/// parallel.
+///
+class FlatTree {
+public:
+    using Index = uint32_t;
+
+    /// \brief The parent of the root
+    static constexpr Index NONE = std::numeric_limits<Index>::max();
+
+private:
+    std::vector<Index> m_nodes;       ///< Node index at each position
+    std::vector<Index> m_parents;     ///< Parent position of each position
+    std::vector<Index> m_first_child; ///< Child range starts, plus one past
+    std::vector<Index> m_first_level; ///< Level range starts, plus one past
+
+public:
+    ///
+    /// \brief Build a tree from an undirected edge list
+    ///
+    /// \param edges Edges of the tree, as node indices
+    /// \param node_count Number of nodes that edges may refer to
+    /// \param root Node index to root the tree at
+    ///
+    FlatTree(std::vector<EdgeKey> const& edges, size_t node_count, Index root);
+
+    /// \brief Get the number of nodes in the tree
+    [[nodiscard]] size_t size() const { return m_nodes.size(); }
+
+    /// \brief Get the bytes held by the tree's arrays
+    [[nodiscard]] size_t memory_usage() const;
+
+    /// \brief Get the node index at a position
+    [[nodiscard]] Index node(size_t pos) const { return m_nodes[pos]; }
+
+    /// \brief Get the parent position of a position, or NONE for the root
+    [[nodiscard]] Index parent(size_t pos) const { return m_parents[pos]; }
+
+    /// \brief Get the positions of the children of a position
+    [[nodiscard]] auto children(size_t pos) const {
+        return xrange<size_t>(m_first_child[pos], m_first_child[pos + 1]);
+    }
+
+    /// \brief Get the number of children of a position
+    [[nodiscard]] size_t child_count(size_t pos) const {
+        return m_first_child[pos + 1] - m_first_child[pos];
+    }
+
+    /// \brief Get the number of levels; the root alone is level 0
+    [[nodiscard]] size_t level_count() const {
+        return m_first_level.size() - 1;
+    }
+
+    /// \brief Get the first position of a level
+    [[nodiscard]] size_t level_begin(size_t l) const {
+        return m_first_level[l];
+    }
+
+    /// \brief Get one past the last position of a level
+    [[nodiscard]] size_t level_end(size_t l) const {
+        return m_first_level[l + 1];
+    }
+};
+
+#endif // FLAT_TREE_H
@@ -0,0 +1,258 @@
+#include "flow_graph_file.h"
+
+#include "global.h"
+#include "trace.h"
+#include "xrange.h"
+
+#include <fmt/printf.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <utility>
+
+using namespace flow_graph_file;
+
+static char const MAGIC[8] = { 'V', 'A', 'S', 'C', 'F', 'L', 'O', 'W' };
+
+static uint64_t align_up(uint64_t offset) { return (offset + 7) / 8 * 8; }
+
+///
+/// \brief Pad a stream with zeros up to a given offset
+///
+static void pad_to(std::ofstream& stream, uint64_t offset) {
+    static char const zeros[8] = {};
+
+    auto at = static_cast<uint64_t>(stream.tellp());
+
+    stream.write(zeros, offset - at);
+}
+
+void write_flow_graph(std::filesystem::path const& path, SimpleGraph const& G) {
+    TraceZone zone("write flow graph");
+
+    std::vector<int64_t> ids;
+    ids.reserve(G.nodes().size());
+
+    for (auto const& [id, node] : G.nodes()) {
+        ids.push_back(id);
+    }
+
+    std::sort(ids.begin(), ids.end());
+
+    if (ids.size() > std::numeric_limits<uint32_t>::max()) {
+        fatal("Flow graph too large for file format!");
+    }
+
+    auto index_of = [&ids](int64_t id) {
+        return static_cast<uint32_t>(
+            std::lower_bound(ids.begin(), ids.end(), id) - ids.begin());
+    };
+
+    Header header {};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version     = VERSION;
+    header.byte_order  = ENDIAN_TAG;
+    header.node_count  = ids.size();
+    header.edge_count  = G.edges().size();
+    header.ids_offset  = align_up(sizeof(Header));
+    header.node_offset =
+        align_up(header.ids_offset + sizeof(int64_t) * ids.size());
+    header.edge_offset =
+        align_up(header.node_offset + sizeof(NodeRecord) * ids.size());
+
+    std::ofstream stream(path, std::ios::binary);
+
+    if (!stream.good()) {
+        fatal("Unable to open flow graph file!");
+    }
+
+    stream.write(reinterpret_cast<char const*>(&header), sizeof(header));
+
+    pad_to(stream, header.ids_offset);
+
+    stream.write(reinterpret_cast<char const*>(ids.data()),
+                 sizeof(int64_t) * ids.size());
+
+    pad_to(stream, header.node_offset);
+
+    for (int64_t id : ids) {
+        auto const& d = G.node(id);
+
+        NodeRecord record { { d.position.x, d.position.y, d.position.z },
+                            d.depth,
+                            d.flow };
+
+        stream.write(reinterpret_cast<char const*>(&record), sizeof(record));
+    }
+
+    pad_to(stream, header.edge_offset);
+
+    std::vector<EdgeRecord> edges;
+    edges.reserve(G.edges().size());
+
+    for (auto const& edge : G.edges()) {
+        edges.push_back({ index_of(edge->a), index_of(edge->b) });
+    }
+
+    // the edge set is hashed by address, so sort to get the same file for
+    // the same graph
+    std::sort(edges.begin(), edges.end(), [](auto const& l, auto const& r) {
+        return std::make_pair(std::min(l.a, l.b), std::max(l.a, l.b)) <
+               std::make_pair(std::min(r.a, r.b), std::max(r.a, r.b));
+    });
+
+    stream.write(reinterpret_cast<char const*>(edges.data()),
+                 sizeof(EdgeRecord) * edges.size());
+
+    if (!stream.good()) {
+        fatal("Unable to write flow graph file!");
+    }
+}
+
+// =============================================================================
+
+MappedFlowGraph::MappedFlowGraph(void const* data, size_t size)
+    : m_data(data),
+      m_size(size),
+      m_header(static_cast<Header const*>(data)) {}
+
+MappedFlowGraph::MappedFlowGraph(MappedFlowGraph&& other) noexcept
+    : m_data(std::exchange(other.m_data, nullptr)),
+      m_size(std::exchange(other.m_size, 0)),
+      m_header(std::exchange(other.m_header, nullptr)) {}
+
+MappedFlowGraph& MappedFlowGraph::operator=(MappedFlowGraph&& other) noexcept {
+    std::swap(m_data, other.m_data);
+    std::swap(m_size, other.m_size);
+    std::swap(m_header, other.m_header);
+    return *this;
+}
+
+MappedFlowGraph::~MappedFlowGraph() {
+    if (m_data) munmap(const_cast<void*>(m_data), m_size);
+}
+
+///
+/// \brief Check that an array of count items of a given size fits in the
+/// file at an aligned offset
+///
+static bool
+array_fits(uint64_t offset, uint64_t count, uint64_t item, uint64_t size) {
+    if (offset % 8 != 0 || offset > size) return false;
+    return count <= (size - offset) / item;
+}
+
+std::optional<MappedFlowGraph>
+MappedFlowGraph::map(std::filesystem::path const& path) {
+    TraceZone zone("map flow graph");
+
+    int fd = open(path.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+        fmt::print("Unable to open flow graph {}\n", path.c_str());
+        return std::nullopt;
+    }
+
+    struct stat info {};
+
+    if (fstat(fd, &info) != 0 ||
+        static_cast<size_t>(info.st_size) < sizeof(Header)) {
+        close(fd);
+        fmt::print("Flow graph {} is too small\n", path.c_str());
+        return std::nullopt;
+    }
+
+    size_t const size = info.st_size;
+
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    // the mapping keeps the file open
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        fmt::print("Unable to map flow graph {}\n", path.c_str());
+        return std::nullopt;
+    }
+
+    MappedFlowGraph graph(data, size);
+
+    auto const& h = *graph.m_header;
+
+    char const* problem = nullptr;
+
+    if (std::memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0) {
+        problem = "is not a flow graph file";
+    } else if (h.byte_order != ENDIAN_TAG) {
+        problem = "has a different byte order";
+    } else if (h.version != VERSION) {
+        problem = "has a different version";
+    } else if (!array_fits(h.ids_offset, h.node_count, sizeof(int64_t), size) ||
+               !array_fits(h.node_offset,
+                           h.node_count,
+                           sizeof(NodeRecord),
+                           size) ||
+               !array_fits(h.edge_offset,
+                           h.edge_count,
+                           sizeof(EdgeRecord),
+                           size)) {
+        problem = "is truncated";
+    }
+
+    if (problem) {
+        fmt::print("Flow graph {} {}\n", path.c_str(), problem);
+        return std::nullopt;
+    }
+
+    return graph;
+}
+
+int64_t const* MappedFlowGraph::ids() const {
+    return reinterpret_cast<int64_t const*>(
+        static_cast<char const*>(m_data) + m_header->ids_offset);
+}
+
+NodeRecord const* MappedFlowGraph::nodes() const {
+    return reinterpret_cast<NodeRecord const*>(
+        static_cast<char const*>(m_data) + m_header->node_offset);
+}
+
+EdgeRecord const* MappedFlowGraph::edges() const {
+    return reinterpret_cast<EdgeRecord const*>(
+        static_cast<char const*>(m_data) + m_header->edge_offset);
+}
+
+SimpleGraph MappedFlowGraph::to_simple_graph() const {
+    auto const* id    = ids();
+    auto const* node  = nodes();
+    auto const* edge  = edges();
+    size_t      count = node_count();
+
+    SimpleGraph G;
+
+    for (size_t i : xrange(count)) {
+        NodeData d;
+        d.position = glm::vec3(
+            node[i].position[0], node[i].position[1], node[i].position[2]);
+        d.depth = node[i].depth;
+        d.flow  = node[i].flow;
+
+        G.add_node(id[i], d);
+    }
+
+    for (size_t i : xrange(edge_count())) {
+        if (edge[i].a >= count || edge[i].b >= count) {
+            fatal("Flow graph edge refers to a missing node!");
+        }
+
+        G.add_edge(id[edge[i].a], id[edge[i].b], {});
+    }
+
+    return G;
+}
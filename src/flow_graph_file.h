@@ -0,0 +1,99 @@
+#ifndef FLOW_GRAPH_FILE_H
+#define FLOW_GRAPH_FILE_H
+
+#include "simplegraph.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+
+///
+/// \brief Flow graph file layout.
+///
+/// A file is a header followed by three arrays, each starting at an offset
+/// given in the header, and aligned to 8 bytes: the original node ids, the
+/// node records, and the edges as pairs of dense node indices. Nodes are
+/// stored in ascending id order, and edges in ascending order of their lower,
+/// then higher node index, so a graph always gives the same file. Edges keep
+/// their direction. Everything is in host byte order; the header holds a byte
+/// order tag so a foreign file is rejected, not misread.
+///
+namespace flow_graph_file {
+
+constexpr uint32_t VERSION    = 1;
+constexpr uint32_t ENDIAN_TAG = 0x01020304;
+
+struct Header {
+    char     magic[8];    ///< "VASCFLOW"
+    uint32_t version;     ///< VERSION
+    uint32_t byte_order;  ///< ENDIAN_TAG, as written by the host
+    uint64_t node_count;  ///< Number of nodes
+    uint64_t edge_count;  ///< Number of edges
+    uint64_t ids_offset;  ///< Offset of int64_t[node_count] node ids
+    uint64_t node_offset; ///< Offset of NodeRecord[node_count]
+    uint64_t edge_offset; ///< Offset of EdgeRecord[edge_count]
+};
+
+struct NodeRecord {
+    float position[3];
+    float depth;
+    float flow;
+};
+
+struct EdgeRecord {
+    uint32_t a; ///< Dense index of the first node
+    uint32_t b; ///< Dense index of the second node
+};
+
+} // namespace flow_graph_file
+
+///
+/// \brief Write a flow graph to a file. Edge data is not stored.
+///
+void write_flow_graph(std::filesystem::path const&, SimpleGraph const&);
+
+///
+/// \brief The MappedFlowGraph class is a read only, memory mapped view of a
+/// flow graph file.
+///
+/// Opening a file only maps and checks the header; the arrays are used in
+/// place, with no parsing. Pages are read in by the OS as they are touched.
+///
+class MappedFlowGraph {
+    void const* m_data = nullptr;
+    size_t      m_size = 0;
+
+    flow_graph_file::Header const* m_header = nullptr;
+
+    MappedFlowGraph(void const* data, size_t size);
+
+public:
+    MappedFlowGraph(MappedFlowGraph&&) noexcept;
+    MappedFlowGraph& operator=(MappedFlowGraph&&) noexcept;
+    ~MappedFlowGraph();
+
+    ///
+    /// \brief Map a flow graph file.
+    ///
+    /// \return The mapped graph, or nothing if the file cannot be mapped or
+    /// is not a valid flow graph file of this version. The reason is printed.
+    ///
+    static std::optional<MappedFlowGraph> map(std::filesystem::path const&);
+
+    [[nodiscard]] size_t node_count() const { return m_header->node_count; }
+    [[nodiscard]] size_t edge_count() const { return m_header->edge_count; }
+
+    /// \brief Get the array of original node ids, by dense index
+    [[nodiscard]] int64_t const* ids() const;
+
+    /// \brief Get the array of node records, by dense index
+    [[nodiscard]] flow_graph_file::NodeRecord const* nodes() const;
+
+    /// \brief Get the array of edges
+    [[nodiscard]] flow_graph_file::EdgeRecord const* edges() const;
+
+    /// \brief Build a SimpleGraph holding this graph, with the original ids
+    [[nodiscard]] SimpleGraph to_simple_graph() const;
+};
+
+#endif // FLOW_GRAPH_FILE_H
@@ -1,8 +1,19 @@
 #include "generate_vessels.h"
 
+#include "border_points.h"
+#include "boruvka.h"
+#include "counter_random.h"
+#include "csrgraph.h"
+#include "disjointset.h"
+#include "distance_transform.h"
+#include "flat_tree.h"
 #include "global.h"
 #include "jobcontroller.h"
+#include "memory_report.h"
+#include "point_index.h"
 #include "simplegraph.h"
+#include "trace.h"
+#include "voxel_blocks.h"
 #include "voxelmesh.h"
 #include "xrange.h"
 
@@ -11,14 +22,14 @@
 #include <fmt/printf.h>
 
 #include <openvdb/tools/GridOperators.h>
+#include <openvdb/tools/Interpolation.h>
+#include <openvdb/tools/Morphology.h>
+#include <openvdb/tree/LeafManager.h>
 
+#include <chrono>
 #include <fstream>
-#include <queue>
-#include <random>
-#include <stack>
-#include <unordered_set>
+#include <limits>
 
-inline bool is_vfrac_in(float value) { return value > .5F; }
 
 /// \brief All adjacent directions for a given cell
 static std::vector<glm::ivec3> const directions = []() {
@@ -39,28 +50,6 @@ static std::vector<glm::ivec3> const directions = []() {
     return ret;
 }();
 
-///
-/// \brief Execute a function over a 3D grid.
-///
-/// \param g Graph to iterate over
-/// \param f Function, of signature (size_t i, size_t j, size_t k) -> void;
-///
-template <class GridType, class Function>
-void over_grid(GridType& g, Function&& f) {
-    auto bb = g.evalActiveVoxelBoundingBox();
-
-    auto l = bb.min();
-    auto h = bb.max();
-
-    for (int32_t i : xrange(l.x(), h.x())) {
-        for (int32_t j : xrange(l.y(), h.y())) {
-            for (int32_t k : xrange(l.z(), h.z())) {
-                f(i, j, k);
-            }
-        }
-    }
-}
-
 ///
 /// \brief Get an id for a coordinate in a grid.
 ///
@@ -82,16 +71,27 @@ id_for_coord(openvdb::CoordBBox const& bb, int32_t x, int32_t y, int32_t z) {
     return lx + hx * (ly + hy * lz);
 };
 
+///
+/// \brief Get the grid coordinate of a node position, before any jitter
+///
+static openvdb::Coord coord_for_position(glm::vec3 p) {
+    return { static_cast<int32_t>(std::lround(p.x)),
+             static_cast<int32_t>(std::lround(p.y)),
+             static_cast<int32_t>(std::lround(p.z)) };
+}
+
 ///
 /// \brief Build initial superflow graph
-/// \param volume_fraction Grid of what is in and outside of a mesh
+/// \param interior Voxels inside the mesh
+/// \param bb Domain of the interior; node ids are taken from it
 /// \param G Superflow graph to build into
 ///
-static void build_initial_networks(openvdb::FloatGrid const& volume_fraction,
+static void build_initial_networks(openvdb::MaskGrid const&  interior,
+                                   openvdb::CoordBBox const& bb,
                                    SimpleTransform const&    transform,
-                                   SimpleGraph&              G) {
+                                   CSRGraph&                 G) {
 
-    auto const& bb = volume_fraction.evalActiveVoxelBoundingBox();
+    TraceZone zone("build networks");
 
     {
         auto bbmin = bb.min();
@@ -132,189 +132,390 @@ static void build_initial_networks(openvdb::FloatGrid const& volume_fraction,
         return d;
     };
 
-    auto accessor = volume_fraction.getConstAccessor();
+    // gather interior voxels per block, so nodes are added in block order
+    VoxelBlocks<openvdb::MaskGrid> blocks(interior);
 
-    // add node and fill with distance to root
-    over_grid(volume_fraction, [&](int32_t i, int32_t j, int32_t k) {
-        bool is_in = is_vfrac_in(accessor.getValue({ i, j, k }));
+    std::vector<std::vector<openvdb::Coord>> block_coords(blocks.size());
+
+    blocks.for_each([&](size_t block, openvdb::Coord coord, bool) {
+        block_coords[block].push_back(coord);
+    });
+
+    {
+        size_t count = 0;
+        for (auto const& list : block_coords) {
+            count += list.size();
+        }
+        G.reserve(count);
+    }
 
-        if (!is_in) return;
+    // add node and fill with distance to root
+    for (auto& list : block_coords) {
+        for (auto const& coord : list) {
+            int64_t cell_id = get_id(coord.x(), coord.y(), coord.z());
 
-        int64_t cell_id = get_id(i, j, k);
+            assert(cell_id > 0);
 
-        assert(cell_id > 0);
+            NodeData data;
+            data.position = glm::vec3(coord.x(), coord.y(), coord.z());
+            data.depth    = distance_to_root(data.position);
 
-        NodeData data;
-        data.position = glm::vec3(i, j, k);
-        data.depth    = distance_to_root(data.position);
+            G.add_node(cell_id, data);
+        }
 
-        G.add_node(cell_id, data);
-    });
+        list = {};
+    }
 
     // normalize
-    for (auto& [key, value] : G.nodes()) {
-        value.data.depth /= max_distance;
+    for (auto& data : G.node_data()) {
+        data.depth /= max_distance;
     }
 }
 
-///@{
-/// Random sources and distributions
-static std::random_device                    random_device;
-static std::mt19937                          random_generator(random_device());
-static std::uniform_real_distribution<float> random_distribution_0_1(0.0, 1.0);
-static std::uniform_real_distribution<float> random_distribution_1_1(-1.0, 1.0);
-///@}
+///
+/// \brief Random streams, one for each use of randomness, so that no two uses
+/// for the same node are correlated
+///
+enum RandomStream : uint64_t {
+    DEPTH_NOISE,
+    JITTER_X,
+    JITTER_Y,
+    JITTER_Z,
+};
 
+///
+/// \brief The Border struct tells where distances to the mesh border come from
+///
+struct Border {
+    /// Interior to find border voxels of
+    openvdb::MaskGrid const& interior;
+
+    /// Signed distance to sample instead, or null. It may be finer than the
+    /// nodes' grid.
+    openvdb::FloatGrid const* distance;
+
+    /// Distance voxels per node voxel, along an axis
+    int factor;
+};
 
 ///
-/// \brief Consider the distance to the root and distances to the edge of the
-/// mesh, and use that to store a 'depth'
+/// \brief Compute the squared distance from every node to the nearest border
+/// voxel
 ///
-/// \param volume_fraction Volume fraction
+/// \param engine Method to use
+/// \param zero_list Border voxels
+/// \param bb Domain of the interior
 /// \param G Superflow graph
-/// \param random_scale Noise scale
+/// \return Distances, in node index order
 ///
-static void sanitize_distances(openvdb::FloatGrid& volume_fraction,
-                               SimpleGraph&        G,
-                               float               random_scale) {
+static std::vector<float>
+squared_border_distances(DistanceEngine                engine,
+                         std::vector<glm::vec3> const& zero_list,
+                         openvdb::CoordBBox const&     bb,
+                         CSRGraph const&               G) {
 
-    // this is stupid, but we use a list of points that are near the border to
-    // compute a distance transform
-    std::vector<glm::vec3> zero_list;
+    // preallocate, because threads will be concurrently updating this structure
+    std::vector<float> distances(G.node_count());
 
-    { // compute the zero list
+    // each job handles a contiguous range of nodes
+    size_t const grain = global_configuration().distance_grain;
 
-        auto accessor = volume_fraction.getConstAccessor();
+    switch (engine) {
+    case DistanceEngine::BRUTE_FORCE: {
+        BorderPoints points(zero_list);
 
-        auto bb = volume_fraction.evalActiveVoxelBoundingBox();
+        fmt::print("Computing signed distances to border, {} kernel\n",
+                   BorderPoints::kernel_name());
 
-        over_grid(volume_fraction, [&](int i, int j, int k) {
-            bool is_in = is_vfrac_in(accessor.getValue({ i, j, k }));
+        parallel_for(G.node_count(), grain, [&](size_t begin, size_t end) {
+            for (size_t nid : xrange(begin, end)) {
+                distances[nid] =
+                    points.min_squared_distance(G.node(nid).position);
+            }
+        });
+    } break;
+    case DistanceEngine::TRANSFORM: {
+        fmt::print("Computing distance transform to border\n");
 
-            // only want ones outside the volume
-            if (is_in) return;
+        DistanceTransform transform(bb, zero_list);
 
-            // if all adj are outside, bail.
+        parallel_for(G.node_count(), grain, [&](size_t begin, size_t end) {
+            for (size_t nid : xrange(begin, end)) {
+                distances[nid] = transform.squared_distance(
+                    glm::ivec3(G.node(nid).position));
+            }
+        });
+    } break;
+    case DistanceEngine::SDF:
+        fatal("The sdf distance engine does not use border points");
+    case DistanceEngine::INDEX: {
+        fmt::print("Indexing {} border points\n", zero_list.size());
 
-            bool keep = false;
+        PointIndex index(zero_list);
 
-            for (auto const& dir : directions) {
-                auto other_coord = glm::ivec3(i, j, k) + dir;
+        parallel_for(G.node_count(), grain, [&](size_t begin, size_t end) {
+            for (size_t nid : xrange(begin, end)) {
+                distances[nid] = index.nearest(G.node(nid).position).distance2;
+            }
+        });
+    } break;
+    }
 
-                int64_t other_cell_id = id_for_coord(
-                    bb, other_coord.x, other_coord.y, other_coord.z);
+    return distances;
+}
 
-                if (other_cell_id < 0) continue;
+///
+/// \brief Time each distance engine on the same graph, and compare results
+/// against the brute force scan.
+///
+static void benchmark_distance_engines(std::vector<glm::vec3> const& zero_list,
+                                       openvdb::CoordBBox const&     bb,
+                                       CSRGraph const&               G) {
 
-                bool other_is_in = is_vfrac_in(accessor.getValue(
-                    { other_coord.x, other_coord.y, other_coord.z }));
+    using Clock = std::chrono::steady_clock;
 
-                if (other_is_in) {
-                    // adjacent to volume. keep;
-                    keep = true;
-                    break;
-                }
-            }
+    std::array<std::pair<DistanceEngine, char const*>, 3> const engines = { {
+        { DistanceEngine::BRUTE_FORCE, "brute_force" },
+        { DistanceEngine::TRANSFORM, "transform" },
+        { DistanceEngine::INDEX, "index" },
+    } };
 
-            if (keep) {
-                zero_list.emplace_back(i, j, k);
-            }
-        });
+    fmt::print("Benchmarking distance engines over {} nodes, {} border "
+               "points\n",
+               G.node_count(),
+               zero_list.size());
+
+    std::vector<float> reference;
+
+    for (auto const& [engine, name] : engines) {
+        auto start = Clock::now();
+
+        auto distances = squared_border_distances(engine, zero_list, bb, G);
+
+        std::chrono::duration<double> elapsed = Clock::now() - start;
+
+        if (reference.empty()) {
+            reference = distances;
+        }
+
+        float max_error = 0;
+
+        for (size_t nid : xrange_over(distances)) {
+            max_error = std::max(max_error,
+                                 std::abs(distances[nid] - reference[nid]));
+        }
+
+        fmt::print("Engine {}: {:.3f}s, max deviation {}\n",
+                   name,
+                   elapsed.count(),
+                   max_error);
     }
+}
+
+///
+/// \brief Find the border voxels of an interior: the voxels outside it, but
+/// next to it across a face, edge or vertex.
+///
+/// The interior is dilated by a voxel and then taken away again, leaving a
+/// one voxel shell. Both steps work on whole leaf bitmasks. Interior tiles
+/// are not split up; instead, each is grown by a voxel with a sparse fill,
+/// which only makes leaves for the new layer. The shell is then gathered in
+/// parallel, a block at a time, so no voxel is seen twice and nothing needs
+/// sorting.
+///
+/// \param bb Domain of the interior; border voxels outside it are dropped
+/// \return Border voxels, in block order
+///
+static std::vector<glm::vec3>
+border_voxels(openvdb::MaskGrid const& interior, openvdb::CoordBBox const& bb) {
+    TraceZone zone("border voxels");
 
-    // now compute distances to these points and store the min for each node in
-    // the graph
+    auto shell = interior.deepCopy();
 
-    std::unordered_map<int64_t, float> distances;
+    openvdb::tools::dilateActiveValues(shell->tree(),
+                                       1,
+                                       openvdb::tools::NN_FACE_EDGE_VERTEX,
+                                       openvdb::tools::IGNORE_TILES);
 
-    // preallocate, because threads will be concurrently updating this structure
-    for (auto& [key, node] : G.nodes()) {
-        distances[key] = 0;
+    auto iter = interior.tree().cbeginValueOn();
+    iter.setMaxDepth(decltype(iter)::LEAF_DEPTH - 1);
+
+    for (; iter; ++iter) {
+        openvdb::CoordBBox tile;
+        iter.getBoundingBox(tile);
+        tile.expand(1);
+
+        shell->sparseFill(tile, true);
     }
 
-    { // compute all in parallel
-        // make sure the controller goes out of scope to finish
-        JobController controller;
+    shell->tree().topologyDifference(interior.tree());
 
-        fmt::print("Computing signed distances to border\n");
+    shell->clip(bb);
 
-        for (auto& [key, node] : G.nodes()) {
-            int64_t   nid   = key;
-            NodeData* ndata = &node.data;
+    VoxelBlocks<openvdb::MaskGrid> blocks(*shell);
 
-            controller.add_job(
-                [nid, ndata, &zero_list, &distances, random_scale]() {
-                    // find min distance
-                    auto node_coord = ndata->position;
+    std::vector<std::vector<glm::vec3>> block_points(blocks.size());
 
-                    float min_squared_distance =
-                        std::numeric_limits<float>::max();
+    blocks.for_each([&](size_t block, openvdb::Coord coord, bool) {
+        block_points[block].emplace_back(coord.x(), coord.y(), coord.z());
+    });
 
-                    for (auto const& z : zero_list) {
-                        float d = glm::distance2(node_coord, z);
+    size_t count = 0;
 
-                        if (d < min_squared_distance) {
-                            min_squared_distance = d;
-                        }
-                    }
+    for (auto const& list : block_points) {
+        count += list.size();
+    }
+
+    std::vector<glm::vec3> points;
+    points.reserve(count);
+
+    for (auto& list : block_points) {
+        points.insert(points.end(), list.begin(), list.end());
+        list = {};
+    }
+
+    return points;
+}
+
+///
+/// \brief Read the squared distance from every node to the border off a
+/// signed distance grid
+///
+/// Interior voxels reach half a voxel outside the surface, and the nearest
+/// border voxel is about that far out again, so the border is taken to be at
+/// a signed distance of .5.
+///
+/// \return Distances, in node index order and node voxels
+///
+static std::vector<float> sampled_border_distances(Border const&   border,
+                                                   CSRGraph const& G) {
+    fmt::print("Sampling signed distances to border\n");
+
+    std::vector<float> distances(G.node_count());
+
+    auto const factor = static_cast<float>(border.factor);
+
+    // the centre of a node voxel, in distance voxels
+    float const offset = (factor - 1) / 2;
+
+    size_t const grain = global_configuration().distance_grain;
+
+    parallel_for(G.node_count(), grain, [&](size_t begin, size_t end) {
+        auto accessor = border.distance->getConstAccessor();
+
+        for (size_t nid : xrange(begin, end)) {
+            auto p = G.node(nid).position * factor + offset;
+
+            float value = openvdb::tools::BoxSampler::sample(
+                accessor, openvdb::Vec3R(p.x, p.y, p.z));
+
+            float d = std::max(0.0F, .5F - value) / factor;
+
+            distances[nid] = d * d;
+        }
+    });
+
+    return distances;
+}
 
-                    float random_value = random_scale * random_distribution_0_1(
-                                                            random_generator);
+///
+/// \brief Consider the distance to the root and distances to the edge of the
+/// mesh, and use that to store a 'depth'
+///
+/// \param border Where border distances come from
+/// \param bb Domain of the interior
+/// \param G Superflow graph
+/// \param random Random source; noise is keyed by node id
+/// \param random_scale Noise scale
+///
+static void sanitize_distances(Border const&             border,
+                               openvdb::CoordBBox const& bb,
+                               CSRGraph&                 G,
+                               CounterRandom const&      random,
+                               float                     random_scale) {
+
+    TraceZone zone("distances");
+
+    // this is stupid, but we use a list of points that are near the border to
+    // compute a distance transform, unless there is a distance grid to sample
+    std::vector<glm::vec3> zero_list;
+
+    std::vector<float> distances;
+
+    if (border.distance) {
+        distances = sampled_border_distances(border, G);
+    } else {
+        zero_list = border_voxels(border.interior, bb);
 
-                    distances.at(nid) = min_squared_distance + random_value;
-                });
+        // now compute distances to these points and store the min for each
+        // node in the graph
+        if (global_configuration().benchmark_distances) {
+            benchmark_distance_engines(zero_list, bb, G);
         }
+
+        distances = squared_border_distances(
+            global_configuration().distance_engine, zero_list, bb, G);
     }
 
+    parallel_for(G.node_count(), 1 << 16, [&](size_t begin, size_t end) {
+        for (size_t nid : xrange(begin, end)) {
+            distances[nid] +=
+                random_scale * random.uniform(G.id(nid), DEPTH_NOISE);
+        }
+    });
+
     // we want distances to be 0 at the core of the input mesh
     fmt::print("Normalizing\n");
 
-    // find the max distance
-    auto iter = std::max_element(
-        distances.begin(), distances.end(), [](auto const& a, auto const& b) {
-            return a.second < b.second;
-        });
+    if (G.node_count() == 0) {
+        fatal("No nodes in graph!");
+    }
 
-    float max_distance = iter->second;
+    // find the max distance
+    float max_distance = *std::max_element(distances.begin(), distances.end());
 
-    for (auto& [key, value] : distances) {
+    for (auto& value : distances) {
         value /= max_distance;
     }
 
-    for (auto& [key, node] : G.nodes()) {
-        node.data.depth = 1.0F - (distances.at(key) * node.data.depth);
+    for (size_t nid : xrange(G.node_count())) {
+        auto& data = G.node(nid);
+        data.depth = 1.0F - (distances[nid] * data.depth);
     }
 
-    if (G.nodes().size() == 0) {
-        fatal("No nodes in graph!");
-    }
+    report_memory("distances",
+                  { { "graph", G.memory_usage() },
+                    { "border points", vector_bytes(zero_list) },
+                    { "distances", vector_bytes(distances) } });
 }
 
 ///
 /// \brief Connect all adjacent nodes based on high-to-low distances
 ///
-static void connect_all_grad(openvdb::FloatGrid const& volume_fraction,
+static void connect_all_grad(openvdb::MaskGrid const&  interior,
+                             openvdb::CoordBBox const& bb,
                              SimpleGraph&              G) {
 
-    auto bb       = volume_fraction.evalActiveVoxelBoundingBox();
-    auto accessor = volume_fraction.getConstAccessor();
+    TraceZone zone("connect");
 
-    over_grid(volume_fraction, [&](int i, int j, int k) {
-        if (accessor.getValue({ i, j, k }) < 0) return;
+    // SimpleGraph is not thread safe, so gather edges per block first
+    VoxelBlocks<openvdb::MaskGrid> blocks(interior);
 
-        auto this_id = id_for_coord(bb, i, j, k);
+    std::vector<std::vector<Edge>> block_edges(blocks.size());
 
+    blocks.for_each([&, accessor = interior.getConstAccessor()](
+                        size_t block, openvdb::Coord coord, bool) {
+        auto this_id = id_for_coord(bb, coord.x(), coord.y(), coord.z());
 
         for (auto const& dir : directions) {
-            auto other_coord = glm::ivec3(i, j, k) + dir;
+            auto other_coord = coord.offsetBy(dir.x, dir.y, dir.z);
 
-            int64_t other_cell_id =
-                id_for_coord(bb, other_coord.x, other_coord.y, other_coord.z);
+            int64_t other_cell_id = id_for_coord(
+                bb, other_coord.x(), other_coord.y(), other_coord.z());
 
             if (other_cell_id < 0) continue;
 
-            bool other_is_in = is_vfrac_in(accessor.getValue(
-                { other_coord.x, other_coord.y, other_coord.z }));
+            bool other_is_in = accessor.isValueOn(other_coord);
 
             if (!other_is_in) continue;
 
@@ -327,9 +528,234 @@ static void connect_all_grad(openvdb::FloatGrid const& volume_fraction,
             EdgeData edata;
             edata.weight = -delta;
 
-            G.add_edge(this_id, other_cell_id, edata);
+            block_edges[block].emplace_back(this_id, other_cell_id, edata);
         }
     });
+
+    for (auto& list : block_edges) {
+        for (auto const& edge : list) {
+            G.add_edge(edge.a, edge.b, edge.data);
+        }
+
+        list = {};
+    }
+}
+
+///
+/// \brief Build a grid mapping voxel coordinates to node indices. Voxels
+/// without a node hold -1.
+///
+static openvdb::Int32Grid::Ptr build_index_grid(CSRGraph const& G) {
+    auto grid = openvdb::Int32Grid::create(-1);
+
+    auto accessor = grid->getAccessor();
+
+    for (size_t nid : xrange(G.node_count())) {
+        accessor.setValue(coord_for_position(G.node(nid).position),
+                          static_cast<int32_t>(nid));
+    }
+
+    return grid;
+}
+
+///
+/// \brief Connect all adjacent nodes based on high-to-low distances
+///
+/// Every pair of adjacent interior voxels is linked; the edge weight is the
+/// negated depth difference, as the higher node would link to the lower.
+///
+/// Work is split over the leaf nodes of the index grid. Neighbors are counted
+/// in parallel, offsets are summed, and then each job writes its nodes'
+/// neighbor lists straight into the pre-sized arrays.
+///
+static void connect_all_grad(CSRGraph& G) {
+    TraceZone zone("connect");
+
+    constexpr size_t LEAVES_PER_JOB = 64;
+
+    auto index_grid = build_index_grid(G);
+
+    openvdb::tree::LeafManager<openvdb::Int32Tree const> leaves(
+        index_grid->tree());
+
+    size_t const node_count = G.node_count();
+
+    // call a function with the index of each node in a range of leaves, and
+    // the index of each adjacent node
+    auto over_leaves = [&](size_t begin, size_t end, auto&& f) {
+        auto accessor = index_grid->getConstAccessor();
+
+        for (size_t l : xrange(begin, end)) {
+            for (auto iter = leaves.leaf(l).cbeginValueOn(); iter; ++iter) {
+                auto nid   = static_cast<CSRGraph::Index>(*iter);
+                auto coord = iter.getCoord();
+
+                for (auto const& dir : directions) {
+                    int32_t other_id =
+                        accessor.getValue(coord.offsetBy(dir.x, dir.y, dir.z));
+
+                    if (other_id < 0) continue;
+
+                    f(nid, static_cast<CSRGraph::Index>(other_id));
+                }
+            }
+        }
+    };
+
+    std::vector<size_t> offsets(node_count + 1, 0);
+
+    parallel_for(
+        leaves.leafCount(), LEAVES_PER_JOB, [&](size_t begin, size_t end) {
+            over_leaves(
+                begin, end, [&](auto nid, auto) { offsets[nid + 1]++; });
+        });
+
+    for (size_t nid : xrange(node_count)) {
+        offsets[nid + 1] += offsets[nid];
+    }
+
+    std::vector<CSRGraph::Index> neighbors(offsets.back());
+    std::vector<float>           weights(offsets.back());
+
+    parallel_for(
+        leaves.leafCount(), LEAVES_PER_JOB, [&](size_t begin, size_t end) {
+            // each node lives in one leaf, so its slots are ours alone. A
+            // node's neighbors are visited together, in direction order, so
+            // the lists match a serial build.
+            int64_t current = -1;
+            size_t  slot    = 0;
+
+            over_leaves(begin, end, [&](auto nid, auto other_id) {
+                if (nid != current) {
+                    current = nid;
+                    slot    = offsets[nid];
+                }
+
+                neighbors[slot] = other_id;
+                weights[slot] =
+                    -std::abs(G.node(nid).depth - G.node(other_id).depth);
+                slot++;
+            });
+        });
+
+    G.set_topology(
+        std::move(offsets), std::move(neighbors), std::move(weights));
+}
+
+///
+/// \brief We only support one component for now, so clean out all but the
+/// largest component.
+///
+static void clean_components(CSRGraph& G) {
+
+    TraceZone zone("components");
+
+    auto components = G.components();
+
+    if (components.sizes.empty()) {
+        fatal("No components found! Broken component cleaner!");
+    }
+
+    fmt::print("Found {} components\n", components.sizes.size());
+
+    auto iter =
+        std::max_element(components.sizes.begin(), components.sizes.end());
+
+    size_t largest_component = std::distance(components.sizes.begin(), iter);
+
+    fmt::print("Using component {} with {} nodes\n", largest_component, *iter);
+
+    G = G.component(components, largest_component);
+}
+
+///
+/// \brief Compute the MST straight from the voxel lattice, without storing any
+/// edges.
+///
+/// Edges are the same as those connect_all_grad would build, but are
+/// generated on the fly from the index grid and node depths. The forest found
+/// is reduced to its largest tree, and G to the nodes of that tree.
+///
+/// \return MST, as an edge list of node indices of G
+///
+static std::vector<EdgeKey> lattice_spanning_tree(CSRGraph& G) {
+    TraceZone zone("lattice spanning tree");
+
+    constexpr size_t NODES_PER_JOB = 1 << 14;
+
+    auto index_grid = build_index_grid(G);
+
+    auto make_visitor = [&]() {
+        return [&G, accessor = index_grid->getConstAccessor()](
+                   CSRGraph::Index nid, auto&& f) mutable {
+            auto  coord = coord_for_position(G.node(nid).position);
+            float depth = G.node(nid).depth;
+
+            for (auto const& dir : directions) {
+                int32_t other_id =
+                    accessor.getValue(coord.offsetBy(dir.x, dir.y, dir.z));
+
+                if (other_id < 0) continue;
+
+                f(static_cast<CSRGraph::Index>(other_id),
+                  -std::abs(depth - G.node(other_id).depth));
+            }
+        };
+    };
+
+    fmt::print("Computing spanning forest on lattice\n");
+
+    auto forest =
+        boruvka_spanning_forest(G.node_count(), NODES_PER_JOB, make_visitor);
+
+    index_grid.reset();
+
+    // the trees of the forest are the components of the graph
+    DisjointSet sets(G.node_count());
+
+    for (auto const& edge : forest) {
+        sets.unite(edge.a, edge.b);
+    }
+
+    if (G.node_count() == 0) {
+        fatal("No components found! Broken component cleaner!");
+    }
+
+    DisjointSet::Index largest = sets.find(0);
+
+    for (size_t nid : xrange(G.node_count())) {
+        auto root = sets.find(nid);
+        if (sets.set_size(root) > sets.set_size(largest)) largest = root;
+    }
+
+    fmt::print("Found {} components\n", G.node_count() - forest.size());
+
+    fmt::print("Using component with {} nodes\n", sets.set_size(largest));
+
+    // nodes keep their order, so new indices are a running count
+    std::vector<bool>    keep(G.node_count());
+    std::vector<int64_t> remap(G.node_count(), -1);
+
+    int64_t next = 0;
+
+    for (size_t nid : xrange(G.node_count())) {
+        keep[nid] = sets.find(nid) == largest;
+
+        if (keep[nid]) remap[nid] = next++;
+    }
+
+    std::vector<EdgeKey> mst;
+    mst.reserve(next > 0 ? next - 1 : 0);
+
+    for (auto const& edge : forest) {
+        if (!keep[edge.a]) continue;
+
+        mst.emplace_back(remap[edge.a], remap[edge.b]);
+    }
+
+    G = G.filtered(keep);
+
+    return mst;
 }
 
 ///
@@ -338,6 +764,8 @@ static void connect_all_grad(openvdb::FloatGrid const& volume_fraction,
 ///
 static void clean_components(SimpleGraph& G) {
 
+    TraceZone zone("components");
+
     // which is the largest?
 
     auto components = G.components();
@@ -377,22 +805,95 @@ static void clean_components(SimpleGraph& G) {
 }
 
 ///
-/// \brief Generate a random vector using a given radius scale
+/// \brief Connect, clean and compute the MST using a SimpleGraph.
 ///
-static glm::vec3 ball_random(float radius) {
-    return glm::vec3(random_distribution_1_1(random_generator),
-                     random_distribution_1_1(random_generator),
-                     random_distribution_1_1(random_generator)) *
-           radius;
+/// This is the original hash map based path, kept for small cases and for
+/// checking the CSR path. G is reduced to the nodes that survive component
+/// cleaning.
+///
+/// \return MST, as an edge list of node indices of G
+///
+static std::vector<EdgeKey>
+simple_graph_spanning_tree(openvdb::MaskGrid const&  interior,
+                           openvdb::CoordBBox const& bb,
+                           CSRGraph&                 G) {
+    SimpleGraph S;
+
+    for (size_t nid : xrange(G.node_count())) {
+        S.add_node(G.id(nid), G.node(nid));
+    }
+
+    fmt::print("Connecting nodes\n");
+    connect_all_grad(interior, bb, S);
+
+    report_memory("connect",
+                  { { "graph", G.memory_usage() },
+                    { "simple graph", S.memory_usage() } });
+
+    fmt::print("Cleaning components\n");
+    clean_components(S);
+
+    report_memory("components",
+                  { { "graph", G.memory_usage() },
+                    { "simple graph", S.memory_usage() } });
+
+    fmt::print("Graph has {} edges. Compute MST\n", S.edge_count());
+
+    auto start = std::chrono::steady_clock::now();
+
+    auto mst = S.compute_min_spanning_tree();
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    fmt::print("MST computed in {:.3f}s\n", elapsed.count());
+
+    report_memory("mst",
+                  { { "graph", G.memory_usage() },
+                    { "simple graph", S.memory_usage() },
+                    { "mst", vector_bytes(mst) } });
+
+    std::vector<bool> keep(G.node_count());
+
+    for (size_t nid : xrange(G.node_count())) {
+        keep[nid] = S.has_node(G.id(nid));
+    }
+
+    G = G.filtered(keep);
+
+    std::unordered_map<int64_t, int64_t> index_of;
+
+    for (size_t nid : xrange(G.node_count())) {
+        index_of[G.id(nid)] = nid;
+    }
+
+    for (auto& edge : mst) {
+        edge = EdgeKey(index_of.at(edge.a), index_of.at(edge.b));
+    }
+
+    return mst;
 }
 
 ///
-/// \brief Jitter node positions
+/// \brief Generate a random vector for a key, using a given radius scale
 ///
-static void reposition(SimpleGraph& G) {
-    for (auto& [key, node] : G.nodes()) {
-        node.data.position +=
-            ball_random(global_configuration().position_randomness);
+static glm::vec3
+ball_random(CounterRandom const& random, uint64_t key, float radius) {
+    return glm::vec3(random.uniform(key, JITTER_X, -1.0F, 1.0F),
+                     random.uniform(key, JITTER_Y, -1.0F, 1.0F),
+                     random.uniform(key, JITTER_Z, -1.0F, 1.0F)) *
+           radius;
+}
+
+void reposition(SimpleGraph& G, uint64_t seed) {
+    TraceZone zone("reposition");
+
+    CounterRandom const random(seed);
+
+    float const radius = global_configuration().position_randomness;
+
+    for (auto& [id, node] : G.nodes()) {
+        node.data.position += ball_random(random, id, radius);
     }
 }
 
@@ -400,290 +901,598 @@ static void reposition(SimpleGraph& G) {
 /// \brief Figure a starting node for our flow tree. Picks the lowest distance
 /// value.
 ///
-static int64_t get_starting_node(SimpleGraph const&     G,
-                                 SimpleTransform const& transform) {
+/// When a root position is given, nodes are compared at their jittered
+/// positions, drawn as reposition() will draw them, so the root is the one
+/// closest after jitter.
+///
+/// \param jitter Jitter radius, in the voxels of G
+/// \return Index of the starting node
+///
+static int64_t get_starting_node(CSRGraph const&        G,
+                                 SimpleTransform const& transform,
+                                 CounterRandom const&   random,
+                                 float                  jitter) {
+
+    auto const& nodes = G.node_data();
 
     if (!global_configuration().root_around) {
         // pick node
 
-        auto iter = std::min_element(G.nodes().begin(),
-                                     G.nodes().end(),
-                                     [](auto const& a, auto const& b) {
-                                         return a.second.data.depth <
-                                                b.second.data.depth;
-                                     });
+        auto iter = std::min_element(
+            nodes.begin(), nodes.end(), [](auto const& a, auto const& b) {
+                return a.depth < b.depth;
+            });
 
-        assert(iter != G.nodes().end());
+        assert(iter != nodes.end());
 
-        return iter->first;
+        return std::distance(nodes.begin(), iter);
     }
 
     glm::vec3 point = transform(*(global_configuration().root_around));
 
     fmt::print("Root should be around: {} {} {}\n", point.x, point.y, point.z);
 
+    int64_t best          = 0;
+    float   best_distance = std::numeric_limits<float>::max();
 
-    auto iter = std::min_element(
-        G.nodes().begin(),
-        G.nodes().end(),
-        [point](auto const& a, auto const& b) {
-            return glm::distance2(a.second.data.position, point) <
-                   glm::distance2(b.second.data.position, point);
-        });
+    for (size_t nid : xrange(G.node_count())) {
+        auto position =
+            nodes[nid].position + ball_random(random, G.id(nid), jitter);
 
-    return iter->first;
+        float d = glm::distance2(position, point);
+
+        if (d < best_distance) {
+            best          = nid;
+            best_distance = d;
+        }
+    }
+
+    return best;
 }
 
 ///
-/// \brief Build a flow tree
+/// \brief Compute 'flow' which is the number of downstream nodes
+///
+/// Levels are reduced deepest first; the nodes of a level are independent, so
+/// each level is split over jobs. Counts are kept as integers, so the result
+/// does not depend on summation order.
 ///
-static SimpleTree build_tree(std::vector<EdgeKey> const& mst,
-                             int64_t                     starting_node) {
+/// \param absorbed Extra downstream volume of each node, by node index, for
+/// parts of the tree that are not resolved as nodes. May be empty.
+/// \return Flow of each node, by node index
+///
+static std::vector<float>
+compute_flow_size(FlatTree const&              tree,
+                  size_t                       node_count,
+                  std::vector<uint64_t> const& absorbed) {
+    TraceZone zone("flow");
+
+    constexpr size_t NODES_PER_JOB = 1 << 14;
+
+    // downstream count, by tree position
+    std::vector<uint64_t> downstream(tree.size(), 0);
 
-    // This is stupid but it makes it easier for me to think about.
+    for (size_t l = tree.level_count(); l-- > 0;) {
+        size_t const first = tree.level_begin(l);
+        size_t const count = tree.level_end(l) - first;
 
-    // We create a graph of the tree first
+        parallel_for(count, NODES_PER_JOB, [&](size_t begin, size_t end) {
+            for (size_t pos : xrange(first + begin, first + end)) {
+                uint64_t sum = tree.child_count(pos);
 
-    SimpleGraph precursor;
+                if (!absorbed.empty()) sum += absorbed[tree.node(pos)];
 
-    for (auto edge : mst) {
-        if (!precursor.has_node(edge.a)) {
-            precursor.add_node(edge.a, {});
+                for (auto child : tree.children(pos)) {
+                    sum += downstream[child];
+                }
+
+                downstream[pos] = sum;
+            }
+        });
+    }
+
+    std::vector<float> ret(node_count, 0.0F);
+
+    parallel_for(tree.size(), NODES_PER_JOB, [&](size_t begin, size_t end) {
+        for (size_t pos : xrange(begin, end)) {
+            ret[tree.node(pos)] = static_cast<float>(downstream[pos]);
         }
+    });
+
+    return ret;
+}
+
+///
+/// \brief build a final graph from flow, the MST, and the superflow graph
+///
+static SimpleGraph build_final_graph(std::vector<float> const& flow_data,
+                                     FlatTree const&           tree,
+                                     CSRGraph const&           G) {
 
-        if (!precursor.has_node(edge.b)) {
-            precursor.add_node(edge.b, {});
+    TraceZone zone("final graph");
+
+    SimpleGraph R;
+
+    for (size_t nid : xrange(G.node_count())) {
+        NodeData d = G.node(nid);
+        d.flow     = flow_data[nid];
+
+        R.add_node(G.id(nid), d);
+    }
+
+    for (size_t pos : xrange(tree.size())) {
+        for (auto child : tree.children(pos)) {
+            R.add_edge(G.id(tree.node(pos)), G.id(tree.node(child)), {});
         }
+    }
 
-        assert(!precursor.has_edge(edge.a, edge.b));
+    return R;
+}
 
-        precursor.add_edge(edge.a, edge.b, {});
+///
+/// \brief Dump voxels to a csv
+///
+static void voxel_debug_dump(openvdb::MaskGrid const& interior,
+                             CSRGraph const&          G) {
+    std::ofstream stream(global_configuration().control_dir / "voxels.csv");
+
+    stream << "x,y,z,depth,vfrac\n";
+
+    auto accessor = interior.getConstAccessor();
+
+    // one row per node, in the order nodes were added
+    for (auto const& data : G.node_data()) {
+        auto coord = coord_for_position(data.position);
+
+        stream << coord.x() << "," << coord.y() << "," << coord.z() << ","
+               << data.depth << "," << (accessor.isValueOn(coord) ? 1 : -1)
+               << "\n";
     }
+}
 
-    assert(precursor.has_node(starting_node));
+///
+/// \brief Build a flow tree over interior voxels
+///
+/// \param interior Voxels to build nodes for
+/// \param border Where border distances come from. Its interior is this one,
+/// unless only part of it is being resolved.
+/// \param bb Domain of the interior
+/// \param dump Dump nodes for debugging
+/// \param G Superflow graph to build into; it is reduced to the tree's nodes
+/// \return Tree, over node indices of G
+///
+static FlatTree build_flow_tree(openvdb::MaskGrid const&  interior,
+                                Border const&             border,
+                                openvdb::CoordBBox const& bb,
+                                SimpleTransform const&    transform,
+                                CounterRandom const&      random,
+                                bool                      dump,
+                                CSRGraph&                 G) {
+    fmt::print("Building initial networks\n");
 
-    // Now we build the tree
+    build_initial_networks(interior, bb, transform, G);
 
-    SimpleTree tree(starting_node);
+    fmt::print("Graph has {} nodes\n", G.node_count());
 
-    std::unordered_set<int64_t> discovered_set;
+    report_memory("build networks",
+                  { { "graph", G.memory_usage() },
+                    { "interior", interior.memUsage() } });
 
-    std::stack<int64_t> stack;
-    stack.push(starting_node);
+    sanitize_distances(border, bb, G, random, 10);
 
-    while (!stack.empty()) {
-        auto node_id = stack.top();
-        stack.pop();
+    if (dump) {
+        voxel_debug_dump(interior, G);
+    }
 
-        if (discovered_set.count(node_id)) continue;
+    std::vector<EdgeKey> mst;
 
-        discovered_set.insert(node_id);
+    if (global_configuration().graph_engine == GraphEngine::SIMPLE) {
+        mst = simple_graph_spanning_tree(interior, bb, G);
+    } else if (global_configuration().graph_engine == GraphEngine::LATTICE) {
+        auto start = std::chrono::steady_clock::now();
 
-        assert(precursor.has_node(node_id));
+        mst = lattice_spanning_tree(G);
 
-        for (auto const& [outgoing_id, edge_data] : precursor.edge(node_id)) {
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
 
-            if (discovered_set.count(outgoing_id)) continue;
+        fmt::print("MST computed in {:.3f}s\n", elapsed.count());
 
-            stack.push(outgoing_id);
+        report_memory("mst",
+                      { { "graph", G.memory_usage() },
+                        { "mst", vector_bytes(mst) } });
+    } else {
+        fmt::print("Connecting nodes\n");
+        connect_all_grad(G);
 
-            assert(!tree.has_node(outgoing_id));
+        report_memory("connect", { { "graph", G.memory_usage() } });
 
-            tree.add_edge(node_id, outgoing_id);
-        }
+        // we may get multiple components. For now, just pick the largest one.
+        fmt::print("Cleaning components\n");
+        clean_components(G);
+
+        report_memory("components", { { "graph", G.memory_usage() } });
+
+        fmt::print("Graph has {} edges. Compute MST\n", G.edge_count());
+
+        auto start = std::chrono::steady_clock::now();
+
+        mst = G.compute_min_spanning_tree(global_configuration().mst_engine);
+
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        fmt::print("MST computed in {:.3f}s\n", elapsed.count());
+
+        report_memory("mst",
+                      { { "graph", G.memory_usage() },
+                        { "mst", vector_bytes(mst) } });
     }
 
-    assert(tree.has_node(starting_node));
+    float const jitter =
+        global_configuration().position_randomness / border.factor;
+
+    auto starting_node = get_starting_node(G, transform, random, jitter);
+
+    fmt::print(
+        "MST has {} edges. Build tree from {}\n", mst.size(), starting_node);
 
-    assert(tree.validate_tree());
+    FlatTree tree(mst, G.node_count(), starting_node);
 
-    assert(precursor.nodes().size() == discovered_set.size());
+    fmt::print("Tree has {} nodes. Compute flow\n", tree.size());
 
-    assert(precursor.nodes().size() == tree.node_count());
+    report_memory("tree",
+                  { { "graph", G.memory_usage() },
+                    { "mst", vector_bytes(mst) },
+                    { "tree", tree.memory_usage() } });
 
     return tree;
 }
 
 ///
-/// \brief Sort nodes of the tree topologically
+/// \brief Get the coarse voxel holding a fine voxel. Coordinates are never
+/// negative, so division rounds down.
 ///
-static std::vector<int64_t> topological_sort(SimpleTree const& tree) {
-    std::vector<int64_t> ret;
+static openvdb::Coord coarse_coord(openvdb::Coord fine, int factor) {
+    return { fine.x() / factor, fine.y() / factor, fine.z() / factor };
+}
 
-    std::unordered_map<int64_t, int64_t> in_degree_map;
+///
+/// \brief Get the fine voxels covered by a coarse voxel
+///
+static openvdb::CoordBBox fine_box(openvdb::Coord coarse, int factor) {
+    openvdb::Coord lo(
+        coarse.x() * factor, coarse.y() * factor, coarse.z() * factor);
 
-    for (auto const& [key, value] : tree) {
-        in_degree_map[key] += 0; // we just want to create it
+    return { lo, lo.offsetBy(factor - 1) };
+}
 
-        for (auto other_id : value.out_ids) {
-            in_degree_map[other_id] += 1;
-        }
-    }
+///
+/// \brief Downsample an interior by an integer factor.
+///
+/// A coarse voxel is inside if at least half of the fine voxels it covers are.
+///
+static openvdb::MaskGrid::Ptr downsample(openvdb::MaskGrid const& fine,
+                                         int                      factor) {
+    TraceZone zone("downsample");
 
-    std::vector<int64_t> zero_in_degree;
+    // interior fine voxels in each coarse voxel
+    auto counts = openvdb::Int32Grid::create(0);
 
-    for (auto const& [key, value] : in_degree_map) {
-        assert(value <= 1);
-        if (value == 0) {
-            zero_in_degree.push_back(key);
-        }
-    }
+    {
+        auto accessor = counts->getAccessor();
 
-    std::erase_if(in_degree_map, [](auto const& c) { return c.second == 0; });
+        for (auto iter = fine.cbeginValueOn(); iter; ++iter) {
+            // a tile can cover many coarse voxels, and some only in part
+            openvdb::CoordBBox box;
+            iter.getBoundingBox(box);
 
+            auto lo = coarse_coord(box.min(), factor);
+            auto hi = coarse_coord(box.max(), factor);
 
-    while (zero_in_degree.size()) {
-        auto node = zero_in_degree.back();
-        zero_in_degree.pop_back();
+            for (int32_t z = lo.z(); z <= hi.z(); z++) {
+                for (int32_t y = lo.y(); y <= hi.y(); y++) {
+                    for (int32_t x = lo.x(); x <= hi.x(); x++) {
+                        openvdb::Coord c(x, y, z);
 
-        for (auto other_id : tree.get_children_of(node)) {
-            in_degree_map.at(other_id) -= 1;
+                        auto overlap = fine_box(c, factor);
+                        overlap.intersect(box);
 
-            if (in_degree_map.at(other_id) == 0) {
-                zero_in_degree.push_back(other_id);
-                in_degree_map.erase(other_id);
+                        accessor.setValue(
+                            c,
+                            accessor.getValue(c) +
+                                static_cast<int32_t>(overlap.volume()));
+                    }
+                }
             }
         }
-
-        ret.push_back(node);
     }
 
-    if (in_degree_map.size()) {
-        fatal("Graph is not DAG!");
+    auto coarse = openvdb::MaskGrid::create();
+
+    int32_t const cell_volume = factor * factor * factor;
+
+    auto accessor = coarse->getAccessor();
+
+    for (auto iter = counts->cbeginValueOn(); iter; ++iter) {
+        if (*iter * 2 >= cell_volume) {
+            accessor.setValueOn(iter.getCoord());
+        }
     }
 
-    return ret;
+    return coarse;
 }
 
 ///
-/// \brief Compute 'flow' which is the number of downstream nodes
+/// \brief Mark the coarse voxels to resolve at the fine level: those of coarse
+/// nodes whose flow, in fine voxels, would survive pruning, and the voxels
+/// next to them. The root is always kept.
 ///
-static std::unordered_map<int64_t, float>
-compute_flow_size(SimpleTree const& tree) {
+static openvdb::MaskGrid::Ptr refined_region(FlatTree const&           tree,
+                                             std::vector<float> const& flow,
+                                             CSRGraph const&           G,
+                                             float cell_volume) {
+    float const prune_flow = global_configuration().prune_flow;
+
+    auto region = openvdb::MaskGrid::create();
 
+    auto accessor = region->getAccessor();
 
-    std::unordered_map<int64_t, float> ret;
+    for (size_t pos : xrange(tree.size())) {
+        auto nid = tree.node(pos);
 
+        if (pos == 0 || (flow[nid] + 1) * cell_volume > prune_flow) {
+            accessor.setValueOn(coord_for_position(G.node(nid).position));
+        }
+    }
 
-    std::vector<int64_t> order = topological_sort(tree);
+    openvdb::tools::dilateActiveValues(
+        region->tree(), 1, openvdb::tools::NN_FACE_EDGE_VERTEX);
 
-    while (!order.empty()) {
+    return region;
+}
 
-        auto id = order.back();
-        order.pop_back();
+///
+/// \brief Keep the voxels of a fine interior that lie in a coarse region
+///
+static openvdb::MaskGrid::Ptr
+restrict_to_region(openvdb::MaskGrid const& fine,
+                   openvdb::MaskGrid const& region,
+                   int                      factor) {
+    TraceZone zone("restrict");
 
-        assert(tree.has_node(id));
+    auto result = openvdb::MaskGrid::create();
 
-        float sum = tree.get_children_of(id).size();
+    for (auto iter = region.cbeginValueOn(); iter; ++iter) {
+        openvdb::CoordBBox box;
+        iter.getBoundingBox(box);
 
-        for (auto cid : tree.get_children_of(id)) {
-            assert(tree.has_node(cid));
-            assert(ret.count(cid));
-            sum += ret.at(cid);
-        }
+        openvdb::CoordBBox cells(fine_box(box.min(), factor).min(),
+                                 fine_box(box.max(), factor).max());
 
-        ret[id] = sum;
+        result->sparseFill(cells, true);
     }
 
+    result->topologyIntersection(fine);
 
-    return ret;
+    return result;
 }
 
 ///
-/// \brief build a final graph from flow, the MST, and the superflow graph
+/// \brief Find the volume each fine node absorbs from coarse branches that
+/// were not refined.
+///
+/// Each coarse node outside the region, with a parent inside it, stands for
+/// its whole subtree. That volume goes to the fine node nearest to it. A
+/// coarse node inside the region whose fine voxels were all dropped, as a
+/// small component, gives its own volume to the nearest fine node too.
+///
+/// \return Absorbed volume in fine voxels, by node index of the fine graph
 ///
-static SimpleGraph
-build_final_graph(std::unordered_map<int64_t, float> const& flow_data,
-                  SimpleTree const&                         tree,
-                  SimpleGraph const&                        G) {
+static std::vector<uint64_t>
+absorbed_flow(FlatTree const&           coarse_tree,
+              std::vector<float> const& coarse_flow,
+              CSRGraph const&           coarse,
+              openvdb::MaskGrid const&  region,
+              int                       factor,
+              CSRGraph const&           fine) {
+    TraceZone zone("absorb");
+
+    std::vector<glm::vec3> positions;
+    positions.reserve(fine.node_count());
+
+    for (auto const& data : fine.node_data()) {
+        positions.push_back(data.position);
+    }
 
-    SimpleGraph R;
+    PointIndex index(positions);
+
+    std::vector<uint64_t> absorbed(fine.node_count(), 0);
 
-    for (auto const& [id, ndata] : G.nodes()) {
-        NodeData d = ndata.data;
-        d.flow     = flow_data.at(id);
+    if (index.empty()) return absorbed;
 
-        R.add_node(id, d);
+    auto const cell_volume = static_cast<uint64_t>(factor * factor * factor);
+
+    auto accessor = region.getConstAccessor();
+
+    auto refined = [&](size_t pos) {
+        auto const& data = coarse.node(coarse_tree.node(pos));
+        return accessor.isValueOn(coord_for_position(data.position));
+    };
+
+    // coarse voxels that still hold a fine node
+    auto kept          = openvdb::MaskGrid::create();
+    auto kept_accessor = kept->getAccessor();
+
+    for (auto const& p : positions) {
+        kept_accessor.setValueOn(coarse_coord(coord_for_position(p), factor));
     }
 
-    for (auto [key, value] : tree.nodes()) {
-        for (auto oid : value.out_ids) {
-            R.add_edge(key, oid, {});
+    size_t dropped = 0;
+
+    for (size_t pos : xrange<size_t>(1, coarse_tree.size())) {
+        auto nid = coarse_tree.node(pos);
+
+        auto coord = coord_for_position(coarse.node(nid).position);
+
+        uint64_t volume = 0;
+
+        if (refined(pos)) {
+            if (kept_accessor.isValueOn(coord)) continue;
+
+            volume = 1;
+            dropped++;
+        } else if (refined(coarse_tree.parent(pos))) {
+            volume = 1 + static_cast<uint64_t>(coarse_flow[nid]);
+        } else {
+            continue;
         }
+
+        // centre of the coarse voxel, in fine voxels
+        auto centre = coarse.node(nid).position * static_cast<float>(factor) +
+                      (factor - 1) / 2.0F;
+
+        absorbed[index.nearest(centre).index] += volume * cell_volume;
     }
 
-    return R;
+    if (dropped > 0) {
+        fmt::print("Moved the volume of {} coarse voxels dropped at full "
+                   "resolution to the nearest kept node\n",
+                   dropped);
+    }
+
+    return absorbed;
 }
 
 ///
-/// \brief Dump voxels to a csv
+/// \brief Build a flow tree coarse to fine.
 ///
-static void voxel_debug_dump(openvdb::FloatGrid::Ptr const& grid,
-                             SimpleGraph const&             G) {
-    std::ofstream stream(global_configuration().control_dir / "voxels.csv");
+/// The tree is first built on the interior downsampled by 2^levels. Only the
+/// neighbourhoods of coarse branches large enough to survive pruning are then
+/// resolved at full resolution, from the full resolution border, so depths
+/// there match a full run. The coarse branches left out are absorbed into the
+/// flow of the fine nodes they hang from. The graph stages then scale with the
+/// volume of the kept vessels, rather than of the whole mesh.
+///
+/// \param distance Signed distance to sample border distances from, or null
+/// \param G Fine superflow graph to build into
+/// \param absorbed Filled with the absorbed volume of each node of G
+/// \return Tree, over node indices of G
+///
+static FlatTree build_refined_tree(openvdb::MaskGrid const&  interior,
+                                   openvdb::CoordBBox const& bb,
+                                   openvdb::FloatGrid const* distance,
+                                   SimpleTransform const&    transform,
+                                   CounterRandom const&      random,
+                                   int                       levels,
+                                   CSRGraph&                 G,
+                                   std::vector<uint64_t>&    absorbed) {
+    TraceZone zone("multiresolution");
 
-    stream << "x,y,z,depth,vfrac\n";
+    int const factor = 1 << levels;
 
-    auto bb = grid->evalActiveVoxelBoundingBox();
+    auto coarse_interior = downsample(interior, factor);
 
-    auto accessor = grid->getConstAccessor();
+    openvdb::CoordBBox const coarse_bb(coarse_coord(bb.min(), factor),
+                                       coarse_coord(bb.max(), factor));
 
-    over_grid(*grid, [&](int i, int j, int k) {
-        auto value = accessor.getValue({ i, j, k });
+    // coarse voxel c is centred on fine voxel c * factor + (factor - 1) / 2
+    SimpleTransform const coarse_transform(
+        transform.scale() / static_cast<float>(factor),
+        (transform.translate() - (factor - 1) / 2.0F) /
+            static_cast<float>(factor));
 
-        if (!is_vfrac_in(value)) return;
+    fmt::print("Building coarse tree, downsampled {}x\n", factor);
 
-        auto id = id_for_coord(bb, i, j, k);
+    CSRGraph coarse;
 
-        if (id < 0) return;
+    auto coarse_tree = build_flow_tree(*coarse_interior,
+                                       { *coarse_interior, distance, factor },
+                                       coarse_bb,
+                                       coarse_transform,
+                                       random,
+                                       false,
+                                       coarse);
 
-        stream << i << "," << j << "," << k << "," << G.node(id).depth << ","
-               << value << "\n";
-    });
-}
+    coarse_interior.reset();
 
+    auto coarse_flow = compute_flow_size(coarse_tree, coarse.node_count(), {});
 
-SimpleGraph generate_vessels(openvdb::FloatGrid::Ptr const& volume_fraction,
-                             SimpleTransform const&         transform) {
+    float const cell_volume = static_cast<float>(factor * factor * factor);
 
-    SimpleGraph G;
+    auto region = refined_region(coarse_tree, coarse_flow, coarse, cell_volume);
 
-    fmt::print("Building initial networks\n");
+    fmt::print("Refining {} of {} coarse voxels\n",
+               region->activeVoxelCount(),
+               coarse_tree.size());
 
-    build_initial_networks(*volume_fraction, transform, G);
+    auto refined = restrict_to_region(interior, *region, factor);
 
-    fmt::print("Graph has {} nodes\n", G.nodes().size());
+    auto tree = build_flow_tree(*refined,
+                                { interior, distance, 1 },
+                                bb,
+                                transform,
+                                random,
+                                global_configuration().dump_voxels,
+                                G);
 
-    sanitize_distances(*volume_fraction, G, 10);
+    absorbed =
+        absorbed_flow(coarse_tree, coarse_flow, coarse, *region, factor, G);
 
-    if (global_configuration().dump_voxels) {
-        voxel_debug_dump(volume_fraction, G);
-    }
+    return tree;
+}
 
-    fmt::print("Connecting nodes\n");
-    connect_all_grad(*volume_fraction, G);
+SimpleGraph generate_vessels(VoxelResult const& voxels, uint64_t seed) {
+    TraceZone zone("generate vessels");
 
-    // we may get multiple components. For now, just pick the largest one.
-    fmt::print("Cleaning components\n");
-    clean_components(G);
+    CounterRandom const random(seed);
 
-    fmt::print("Graph has {} edges. Compute MST\n", G.edge_count());
-    auto mst = G.compute_min_spanning_tree();
+    openvdb::FloatGrid const* distance = nullptr;
 
-    reposition(G);
+    if (global_configuration().distance_engine == DistanceEngine::SDF) {
+        if (!voxels.distance) {
+            fatal("No signed distance grid for the sdf distance engine!");
+        }
 
-    auto starting_node = get_starting_node(G, transform);
+        distance = voxels.distance.get();
+    }
 
-    fmt::print(
-        "MST has {} edges. Build tree from {}\n", mst.size(), starting_node);
+    auto const& interior = *voxels.interior;
+
+    int const levels = global_configuration().multires_levels;
+
+    CSRGraph              G;
+    std::vector<uint64_t> absorbed;
 
-    auto tree = build_tree(mst, starting_node);
+    FlatTree tree = levels > 0
+                        ? build_refined_tree(interior,
+                                             voxels.domain,
+                                             distance,
+                                             voxels.tf,
+                                             random,
+                                             levels,
+                                             G,
+                                             absorbed)
+                        : build_flow_tree(interior,
+                                          { interior, distance, 1 },
+                                          voxels.domain,
+                                          voxels.tf,
+                                          random,
+                                          global_configuration().dump_voxels,
+                                          G);
 
-    fmt::print("Tree has {} nodes. Compute flow\n", tree.node_count());
+    auto flow = compute_flow_size(tree, G.node_count(), absorbed);
 
-    auto flow = compute_flow_size(tree);
+    fmt::print("Flow complete, building final graph\n");
 
-    fmt::print("Flow complete, building final graph\n", tree.node_count());
+    report_memory("flow",
+                  { { "graph", G.memory_usage() },
+                    { "tree", tree.memory_usage() },
+                    { "flow", vector_bytes(flow) } });
 
-    return build_final_graph(flow, tree, G);
+    auto R = build_final_graph(flow, tree, G);
+
+    report_memory("final graph", { { "flow graph", R.memory_usage() } });
+
+    return R;
 }
@@ -3,17 +3,23 @@
 
 #include "simplegraph.h"
 
-#include <openvdb/openvdb.h>
+#include <cstdint>
 
-class SimpleTransform;
+struct VoxelResult;
 
 ///
 /// \brief Generate a vessel flow graph
-/// \param volume_fraction Voxel grid representing volume fraction
-/// \param transform Mesh to grid transform
+/// \param voxels Voxelized mesh
+/// \param seed Seed for all randomness
 ///
-SimpleGraph generate_vessels(openvdb::FloatGrid::Ptr const& volume_fraction,
-                             SimpleTransform const&         transform);
+SimpleGraph generate_vessels(VoxelResult const& voxels, uint64_t seed);
+
+///
+/// \brief Jitter the node positions of a flow graph, by position_randomness.
+///
+/// Jitter is keyed by node id, so it is the same whatever the node order.
+///
+void reposition(SimpleGraph& G, uint64_t seed);
 
 
 #endif // GENERATE_VESSELS_H
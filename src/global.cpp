@@ -3,6 +3,7 @@
 #include <fmt/color.h>
 #include <fmt/printf.h>
 
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 #include <string_view>
@@ -54,6 +55,72 @@ std::istream& operator>>(std::istream& stream, glm::vec3& v) {
     return stream >> v.x >> v.y >> v.z;
 }
 
+std::istream& operator>>(std::istream& stream, DistanceEngine& engine) {
+    std::string name;
+    stream >> name;
+
+    if (name == "brute_force") {
+        engine = DistanceEngine::BRUTE_FORCE;
+    } else if (name == "transform") {
+        engine = DistanceEngine::TRANSFORM;
+    } else if (name == "index") {
+        engine = DistanceEngine::INDEX;
+    } else if (name == "sdf") {
+        engine = DistanceEngine::SDF;
+    } else {
+        fatal("Unknown distance engine");
+    }
+
+    return stream;
+}
+
+std::istream& operator>>(std::istream& stream, GraphEngine& engine) {
+    std::string name;
+    stream >> name;
+
+    if (name == "simple") {
+        engine = GraphEngine::SIMPLE;
+    } else if (name == "csr") {
+        engine = GraphEngine::CSR;
+    } else if (name == "lattice") {
+        engine = GraphEngine::LATTICE;
+    } else {
+        fatal("Unknown graph engine");
+    }
+
+    return stream;
+}
+
+std::istream& operator>>(std::istream& stream, MSTEngine& engine) {
+    std::string name;
+    stream >> name;
+
+    if (name == "kruskal") {
+        engine = MSTEngine::KRUSKAL;
+    } else if (name == "boruvka") {
+        engine = MSTEngine::BORUVKA;
+    } else {
+        fatal("Unknown MST engine");
+    }
+
+    return stream;
+}
+
+std::istream& operator>>(std::istream& stream, MeshCombine& combine) {
+    std::string name;
+    stream >> name;
+
+    if (name == "intersection") {
+        combine = MeshCombine::INTERSECTION;
+    } else if (name == "union") {
+        combine = MeshCombine::UNION;
+    } else {
+        fatal("Unknown mesh combine");
+    }
+
+    return stream;
+}
+
 ///
 /// \brief Check a map for a given key, if it exists, interpret the value as T.
 ///
@@ -138,6 +205,10 @@ bool parse_arguments(int argc, char* argv[]) {
 
     wire(file_data, "voxel_size", c.cube_size);
 
+    wire(file_data, "voxel_memory_budget", c.voxel_memory_budget);
+
+    wire(file_data, "mesh_combine", c.mesh_combine);
+
     {
         std::string raw_path;
 
@@ -160,6 +231,8 @@ bool parse_arguments(int argc, char* argv[]) {
         c.position_randomness = std::max(0.0f, c.position_randomness);
     }
 
+    wire(file_data, "seed", c.seed);
+
     {
         wire(file_data, "prune", c.prune_rounds);
 
@@ -174,6 +247,58 @@ bool parse_arguments(int argc, char* argv[]) {
 
     wire(file_data, "dump_voxels", c.dump_voxels);
 
+    {
+        std::string raw_path;
+
+        if (wire(file_data, "memory_report", raw_path)) {
+            c.memory_report = c.control_dir / "." / raw_path;
+        }
+    }
+
+    {
+        std::string raw_path;
+
+        if (wire(file_data, "trace", raw_path)) {
+            c.trace = c.control_dir / "." / raw_path;
+        }
+    }
+
+    {
+        std::string raw_path;
+
+        if (wire(file_data, "checkpoint_dir", raw_path)) {
+            c.checkpoint_dir = c.control_dir / "." / raw_path;
+        }
+    }
+
+    {
+        std::string raw_path;
+
+        if (wire(file_data, "flow_graph_output", raw_path)) {
+            c.flow_graph_output = c.control_dir / "." / raw_path;
+        }
+    }
+
+    wire(file_data, "distance_engine", c.distance_engine);
+
+    wire(file_data, "benchmark_distances", c.benchmark_distances);
+
+    {
+        wire(file_data, "distance_grain", c.distance_grain);
+
+        c.distance_grain = std::max<size_t>(1, c.distance_grain);
+    }
+
+    wire(file_data, "graph_engine", c.graph_engine);
+
+    wire(file_data, "mst_engine", c.mst_engine);
+
+    {
+        wire(file_data, "multires_levels", c.multires_levels);
+
+        c.multires_levels = std::clamp(c.multires_levels, 0, 8);
+    }
+
     // validate
 
     if (!std::filesystem::is_regular_file(c.mesh_path)) {
@@ -187,6 +312,13 @@ bool parse_arguments(int argc, char* argv[]) {
 
     if (c.cube_size <= 0) return false;
 
+    if (c.distance_engine == DistanceEngine::SDF && c.voxel_memory_budget > 0) {
+        fmt::print(fg(fmt::terminal_color::red),
+                   "The sdf distance engine needs untiled voxelization.");
+
+        return false;
+    }
+
 
     return true;
 }
@@ -3,9 +3,54 @@
 
 #include "glm_include.h"
 
+#include <cstdint>
 #include <filesystem>
+#include <iosfwd>
 #include <optional>
 
+///
+/// \brief Methods to compute the distance from a voxel to the mesh border
+///
+enum class DistanceEngine {
+    BRUTE_FORCE, ///< Scan every border voxel, for every node
+    TRANSFORM,   ///< Exact distance transform over a dense copy of the box
+    INDEX,       ///< Nearest border voxel queries against a kd-tree
+    SDF,         ///< Sample the mesh signed distance kept from voxelization
+};
+
+std::istream& operator>>(std::istream&, DistanceEngine&);
+
+///
+/// \brief Graph representations for the flow graph stages
+///
+enum class GraphEngine {
+    SIMPLE,  ///< Hash map based SimpleGraph; for small cases and debugging
+    CSR,     ///< Compact compressed sparse row graph
+    LATTICE, ///< No stored edges; spanning tree is found on the voxel lattice
+};
+
+std::istream& operator>>(std::istream&, GraphEngine&);
+
+///
+/// \brief Minimum spanning tree algorithms for the CSR graph
+///
+enum class MSTEngine {
+    KRUSKAL, ///< Serial sort and union
+    BORUVKA, ///< Parallel cheapest-edge contraction
+};
+
+std::istream& operator>>(std::istream&, MSTEngine&);
+
+///
+/// \brief Ways to combine several meshes into one volume
+///
+enum class MeshCombine {
+    INTERSECTION, ///< Inside every mesh
+    UNION,        ///< Inside any mesh
+};
+
+std::istream& operator>>(std::istream&, MeshCombine&);
+
 struct Configuration {
     std::filesystem::path control_dir; ///< Path to control directory
 
@@ -17,10 +62,37 @@ struct Configuration {
 
     float position_randomness = .5; ///< Random perturbation to node points
 
+    std::optional<uint64_t> seed; ///< Random seed; drawn at startup if unset
+
     int   prune_rounds = 3; ///< Rounds of pruning to execute
     float prune_flow   = 0; ///< Flow size <= we prune
 
     bool dump_voxels = false; ///< Dump voxels for debugging
+
+    std::filesystem::path memory_report; ///< Memory csv path; empty for none
+    std::filesystem::path trace;         ///< Trace json path; empty for none
+
+    /// Directory to save and restore stage results; empty for none
+    std::filesystem::path checkpoint_dir;
+
+    std::filesystem::path flow_graph_output; ///< Flow graph file; or none
+
+    /// Method to compute distances to the mesh border
+    DistanceEngine distance_engine = DistanceEngine::INDEX;
+
+    bool benchmark_distances = false; ///< Time and compare distance engines
+
+    size_t distance_grain = 1024; ///< Nodes per job, for border distances
+
+    size_t voxel_memory_budget = 0; ///< MiB for tiled voxelization; 0 untiled
+
+    MeshCombine mesh_combine = MeshCombine::INTERSECTION; ///< Multiple meshes
+
+    GraphEngine graph_engine = GraphEngine::CSR; ///< Flow graph representation
+
+    MSTEngine mst_engine = MSTEngine::BORUVKA; ///< MST method, for CSR graphs
+
+    int multires_levels = 0; ///< Coarse levels to build the tree from; 0 none
 };
 
 ///
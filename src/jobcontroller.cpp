@@ -1,7 +1,12 @@
 #include "jobcontroller.h"
 
+#include "trace.h"
+
 #include <fmt/printf.h>
 
+/// The executor whose loop the current thread runs, if any
+static thread_local Executor const* current_executor = nullptr;
+
 Executor::Executor(size_t num_threads) {
 
     if (num_threads == 0) {
@@ -17,6 +22,8 @@ Executor::Executor(size_t num_threads) {
 
     for (size_t i = 0; i < num_threads; ++i) {
         m_workers.emplace_back([this] {
+            current_executor = this;
+
             // Each thread is a loop
 
             while (true) {
@@ -48,6 +55,8 @@ Executor::Executor(size_t num_threads) {
                 }
 
                 // Execute the task
+                TraceZone zone("task");
+
                 task();
             }
         });
@@ -68,6 +77,10 @@ Executor::~Executor() {
     }
 }
 
+bool Executor::is_worker_thread() const {
+    return current_executor == this;
+}
+
 // =============================================================================
 
 void JobController::flush() {
@@ -79,15 +92,21 @@ void JobController::flush() {
 }
 
 static size_t get_number_of_threads() {
-    size_t threads = std::thread::hardware_concurrency();
+    // shared by the loop executor and every controller, so only query and
+    // report the count once
+    static size_t const threads = []() -> size_t {
+        size_t count = std::thread::hardware_concurrency();
 
-    // Some implementations don't provide the thread count, and return a 0
-    if (threads < 1) {
+        // Some implementations don't provide the thread count, and return a 0
+        if (count < 1) {
 
-        threads = 4;
-    }
+            count = 4;
+        }
+
+        fmt::print("Using {} threads\n", count);
 
-    fmt::print("Using {} threads\n", threads);
+        return count;
+    }();
 
     return threads;
 }
@@ -100,3 +119,10 @@ JobController::~JobController() {
         flush();
     }
 }
+
+Executor& shared_executor() {
+    // never destroyed; a fatal() inside a loop calls exit() from a worker,
+    // which could not join itself
+    static Executor* executor = new Executor(get_number_of_threads());
+    return *executor;
+}
@@ -1,6 +1,7 @@
 #ifndef JOBCONTROLLER_H
 #define JOBCONTROLLER_H
 
+#include <algorithm>
 #include <future>
 #include <queue>
 #include <thread>
@@ -27,6 +28,10 @@ public:
     /// \brief Get the number of workers
     size_t size() const { return m_workers.size(); }
 
+    ///
+    /// \brief Check if the calling thread is one of this executor's workers
+    bool is_worker_thread() const;
+
     ///
     /// \brief Add a task to the executor
     ///
@@ -110,4 +115,48 @@ public:
     }
 };
 
+///
+/// \brief Get the executor shared by all parallel loops.
+///
+/// It is started on first use with one worker per core, and lives until the
+/// program exits, so loops don't pay for thread creation.
+///
+Executor& shared_executor();
+
+///
+/// \brief Run a function over the range [0, count) in contiguous chunks.
+///
+/// The function is of signature (size_t begin, size_t end) -> void, and is
+/// called once per chunk of at most grain items. If the whole range fits in a
+/// single chunk, or this is called from inside another parallel loop, chunks
+/// are run on the calling thread. Returns when all chunks are complete.
+///
+template <class Function>
+void parallel_for(size_t count, size_t grain, Function f) {
+    grain = std::max<size_t>(grain, 1);
+
+    auto& executor = shared_executor();
+
+    // a worker waiting on its own pool could leave no one to run the chunks
+    if (count <= grain or executor.is_worker_thread()) {
+        for (size_t begin = 0; begin < count; begin += grain) {
+            f(begin, std::min(begin + grain, count));
+        }
+        return;
+    }
+
+    std::vector<std::future<void>> jobs;
+    jobs.reserve((count + grain - 1) / grain);
+
+    for (size_t begin = 0; begin < count; begin += grain) {
+        size_t end = std::min(begin + grain, count);
+
+        jobs.push_back(executor.enqueue([begin, end, &f]() { f(begin, end); }));
+    }
+
+    for (auto& job : jobs) {
+        job.get();
+    }
+}
+
 #endif // JOBCONTROLLER_H
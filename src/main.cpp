@@ -1,6 +1,10 @@
+#include "checkpoint.h"
+#include "flow_graph_file.h"
 #include "generate_vessels.h"
 #include "global.h"
+#include "memory_report.h"
 #include "mesh_write.h"
+#include "trace.h"
 #include "voxelmesh.h"
 #include "wavefrontimport.h"
 #include "xrange.h"
@@ -10,6 +14,8 @@
 
 #include <openvdb/openvdb.h>
 
+#include <random>
+
 int main(int argc, char* argv[]) {
 
     if (!parse_arguments(argc, argv)) {
@@ -18,29 +24,85 @@ int main(int argc, char* argv[]) {
 
     openvdb::initialize();
 
-    fmt::print(fg(fmt::terminal_color::green),
-               "Loading mesh {}, dicing at {}\n",
-               global_configuration().mesh_path,
-               global_configuration().cube_size);
+    // before any worker threads exist
+    if (!global_configuration().trace.empty()) {
+        start_trace();
+    }
+
+    uint64_t const seed =
+        global_configuration().seed.value_or(std::random_device()());
+
+    fmt::print("Random seed {}\n", seed);
+
+    Checkpoints const checkpoints(global_configuration());
+
+    auto voxel_result = checkpoints.load_voxels();
 
-    auto imported_mesh = import_wavefront(global_configuration().mesh_path);
+    if (!voxel_result) {
+        fmt::print(fg(fmt::terminal_color::green),
+                   "Loading mesh {}, dicing at {}\n",
+                   global_configuration().mesh_path,
+                   global_configuration().cube_size);
 
-    fmt::print(fg(fmt::terminal_color::green),
-               "Mesh imported, creating voxels...\n");
+        auto imported_mesh =
+            import_wavefront(global_configuration().mesh_path);
 
-    auto [voxels, tf] = voxelize(std::move(imported_mesh.objects),
-                                 global_configuration().cube_size);
+        {
+            size_t mesh_bytes = 0;
 
-    fmt::print(fg(fmt::terminal_color::green),
-               "Finished voxel grid, building flow graph...\n");
+            for (auto const& object : imported_mesh.objects) {
+                for (auto const& mesh : object.meshes) {
+                    mesh_bytes += vector_bytes(mesh.vertex());
+                    mesh_bytes += vector_bytes(mesh.faces());
+                }
+            }
+
+            report_memory("import", { { "mesh", mesh_bytes } });
+        }
+
+        fmt::print(fg(fmt::terminal_color::green),
+                   "Mesh imported, creating voxels...\n");
+
+        voxel_result = voxelize(std::move(imported_mesh.objects),
+                                global_configuration().cube_size);
+
+        checkpoints.save_voxels(*voxel_result);
+    }
 
-    auto flow_graph = generate_vessels(voxels, tf);
+    auto const& voxels = *voxel_result;
+
+    report_memory(
+        "voxelize",
+        { { "interior", voxels.interior->memUsage() },
+          { "distance", voxels.distance ? voxels.distance->memUsage() : 0 } });
+
+    auto flow_graph = checkpoints.load_flow_graph();
+
+    if (!flow_graph) {
+        fmt::print(fg(fmt::terminal_color::green),
+                   "Finished voxel grid, building flow graph...\n");
+
+        flow_graph.emplace(generate_vessels(voxels, seed));
+
+        checkpoints.save_flow_graph(*flow_graph);
+    }
+
+    // jitter comes after the checkpoint, so it can be tuned without a rebuild;
+    // only a root_at root was picked at its jittered position
+    reposition(*flow_graph, seed);
+
+    if (!global_configuration().flow_graph_output.empty()) {
+        write_flow_graph(global_configuration().flow_graph_output,
+                         *flow_graph);
+    }
 
     auto out_path = global_configuration().output_path;
 
     fmt::print(fg(fmt::terminal_color::green), "Creating geometry...\n");
 
-    write_mesh_to(flow_graph, tf, out_path);
+    write_mesh_to(*flow_graph, voxels.tf, out_path);
+
+    write_trace(global_configuration().trace);
 
     fmt::print(fg(fmt::terminal_color::green), "Done.\n");
 
@@ -0,0 +1,113 @@
+#include "memory_report.h"
+
+#include "global.h"
+
+#include <fmt/printf.h>
+
+#include <sys/resource.h>
+
+#ifdef __APPLE__
+#    include <mach/mach.h>
+#else
+#    include <unistd.h>
+#endif
+
+#include <fstream>
+#include <mutex>
+#include <optional>
+
+///
+/// \brief Get the current resident set size in bytes, or nothing if it cannot
+/// be read on this platform.
+///
+static std::optional<size_t> resident_bytes() {
+#ifdef __APPLE__
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t      count = MACH_TASK_BASIC_INFO_COUNT;
+
+    if (task_info(mach_task_self(),
+                  MACH_TASK_BASIC_INFO,
+                  reinterpret_cast<task_info_t>(&info),
+                  &count) != KERN_SUCCESS) {
+        return std::nullopt;
+    }
+
+    return info.resident_size;
+#else
+    std::ifstream statm("/proc/self/statm");
+
+    size_t total_pages    = 0;
+    size_t resident_pages = 0;
+
+    if (!(statm >> total_pages >> resident_pages)) return std::nullopt;
+
+    return resident_pages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+///
+/// \brief Get the peak resident set size of the process in bytes
+///
+static size_t peak_resident_bytes() {
+    rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+
+#ifdef __APPLE__
+    return usage.ru_maxrss; // already bytes
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024; // kilobytes
+#endif
+}
+
+static double to_mib(size_t bytes) { return bytes / (1024.0 * 1024.0); }
+
+void report_memory(char const* stage, std::initializer_list<MemoryHeld> held) {
+    static std::mutex    mutex;
+    static size_t        last_resident = 0;
+    static std::ofstream csv;
+
+    std::scoped_lock lock(mutex);
+
+    size_t resident = resident_bytes().value_or(0);
+    size_t peak     = peak_resident_bytes();
+
+    auto delta = static_cast<double>(resident) - last_resident;
+
+    last_resident = resident;
+
+    fmt::print("Memory after {}: resident {:.1f} MiB ({:+.1f} MiB), peak "
+               "{:.1f} MiB\n",
+               stage,
+               to_mib(resident),
+               delta / (1024.0 * 1024.0),
+               to_mib(peak));
+
+    for (auto const& item : held) {
+        fmt::print("    {}: {:.1f} MiB\n", item.name, to_mib(item.bytes));
+    }
+
+    auto const& path = global_configuration().memory_report;
+
+    if (path.empty()) return;
+
+    if (!csv.is_open()) {
+        csv.open(path);
+
+        if (!csv.good()) {
+            fatal("Unable to open memory report file!");
+        }
+
+        csv << "stage,item,bytes\n";
+    }
+
+    csv << stage << ",resident," << resident << "\n";
+    csv << stage << ",resident_delta," << static_cast<int64_t>(delta) << "\n";
+    csv << stage << ",peak_resident," << peak << "\n";
+
+    for (auto const& item : held) {
+        csv << stage << "," << item.name << "," << item.bytes << "\n";
+    }
+
+    // flush each stage, so a run that dies still leaves its numbers
+    csv.flush();
+}
@@ -0,0 +1,33 @@
+#ifndef MEMORY_REPORT_H
+#define MEMORY_REPORT_H
+
+#include <cstddef>
+#include <initializer_list>
+#include <vector>
+
+///
+/// \brief The MemoryHeld struct names a major structure and the bytes it
+/// holds
+///
+struct MemoryHeld {
+    char const* name;
+    size_t      bytes;
+};
+
+///
+/// \brief Report memory use at the end of a pipeline stage.
+///
+/// Prints the resident set size, its change since the last report, the peak
+/// resident set size, and the bytes held by the given structures. If the
+/// `memory_report` option is set, the same numbers are appended to that file
+/// as csv rows of stage, item and bytes.
+///
+void report_memory(char const* stage, std::initializer_list<MemoryHeld> = {});
+
+/// \brief Get the bytes held by a vector's storage
+template <class T>
+size_t vector_bytes(std::vector<T> const& v) {
+    return v.capacity() * sizeof(T);
+}
+
+#endif // MEMORY_REPORT_H
@@ -0,0 +1,29 @@
+#include "mesh_soup.h"
+
+#include "wavefrontimport.h"
+
+#include <algorithm>
+
+MeshSoup::MeshSoup(std::vector<MutableObject> const& objects) {
+    m_first_face.push_back(0);
+
+    for (auto const& o : objects) {
+        for (auto const& m : o.meshes) {
+            m_meshes.push_back(&m);
+            m_first_face.push_back(m_first_face.back() + m.faces().size());
+            m_point_count += m.vertex().size();
+        }
+    }
+}
+
+void MeshSoup::getIndexSpacePoint(size_t          n,
+                                  size_t          v,
+                                  openvdb::Vec3d& pos) const {
+    // the last range start at or before n is the mesh holding it
+    auto iter =
+        std::upper_bound(m_first_face.begin(), m_first_face.end(), n) - 1;
+
+    size_t mesh = std::distance(m_first_face.begin(), iter);
+
+    m_meshes[mesh]->getIndexSpacePoint(n - *iter, v, pos);
+}
@@ -0,0 +1,36 @@
+#ifndef MESH_SOUP_H
+#define MESH_SOUP_H
+
+#include <openvdb/openvdb.h>
+
+#include <vector>
+
+class MutableMesh;
+struct MutableObject;
+
+///
+/// \brief The MeshSoup class presents the meshes of several objects to the
+/// OpenVDB mesh adapter concept as one polygon soup, without copying them.
+///
+/// Polygons are numbered mesh after mesh. The meshes must outlive the soup.
+///
+class MeshSoup {
+    std::vector<MutableMesh const*> m_meshes;
+    std::vector<size_t> m_first_face; ///< Face range starts, plus one past
+    size_t              m_point_count = 0;
+
+public:
+    explicit MeshSoup(std::vector<MutableObject> const& objects);
+
+    /// \brief Get the number of meshes in the soup
+    [[nodiscard]] size_t mesh_count() const { return m_meshes.size(); }
+
+    // support openVDB MeshDataAdapter concept
+public:
+    size_t polygonCount() const { return m_first_face.back(); }
+    size_t pointCount() const { return m_point_count; }
+    size_t vertexCount(size_t) const { return 3; }
+    void   getIndexSpacePoint(size_t n, size_t v, openvdb::Vec3d& pos) const;
+};
+
+#endif // MESH_SOUP_H
@@ -1,13 +1,17 @@
 #include "mesh_write.h"
 #include "global.h"
 #include "jobcontroller.h"
+#include "memory_report.h"
+#include "trace.h"
 #include "voxelmesh.h"
 #include "xrange.h"
 
 #include <openvdb/tools/Composite.h>
 #include <openvdb/tools/VolumeToMesh.h>
 
+#include <algorithm>
 #include <fstream>
+#include <vector>
 
 using ByteTree = openvdb::tree::Tree4<uint8_t, 5, 4, 3>::Type;
 using ByteGrid = openvdb::Grid<ByteTree>;
@@ -30,6 +34,8 @@ float compute_radius(float flow) {
 /// \brief Prune leaves and nodes that dont meet the flow requirements
 ///
 void prune(SimpleGraph& G) {
+    TraceZone zone("prune");
+
     int   rounds = global_configuration().prune_rounds;
     float flow   = global_configuration().prune_flow;
 
@@ -77,34 +83,56 @@ void prune(SimpleGraph& G) {
 }
 
 ///
-/// \brief Relax node positions
-/// \param G Graph
-/// \param a Upstream node
-/// \param n Node
-/// \param b Downstream node
-///
-void relax_part(SimpleGraph& G, int64_t a, int64_t n, int64_t b) {
-    auto apos = G.node(a).position;
-    auto npos = G.node(n).position;
-    auto bpos = G.node(b).position;
-
-    glm::vec3 midpoint = (apos + bpos) / 2.0f;
-
-    glm::vec3 new_pos = (midpoint - npos) * RELAXATION_FACTOR + npos;
-
-    G.node(n).position = new_pos;
+/// \brief Relax a node position
+/// \param a Upstream node position
+/// \param n Node position
+/// \param b Downstream node position
+/// \return The relaxed node position
+static glm::vec3 relax_part(glm::vec3 a, glm::vec3 n, glm::vec3 b) {
+    glm::vec3 midpoint = (a + b) / 2.0f;
+
+    return (midpoint - n) * RELAXATION_FACTOR + n;
 }
 
 ///
 /// \brief Relax all nodes
 ///
+/// Nodes are moved in place, one after another, in id order, and each node
+/// visits its neighbours in id order. The result therefore does not depend on
+/// the order the graph was built in, so a graph loaded from a checkpoint
+/// relaxes exactly like a freshly generated one.
+///
 void relax(SimpleGraph& G) {
+    TraceZone zone("relax");
+
+    std::vector<int64_t> order;
+    order.reserve(G.nodes().size());
+
     for (auto const& [nid, ndata] : G.nodes()) {
-        for (auto const& ea : G.edge(nid)) {
-            for (auto const& eb : G.edge(nid)) {
-                if (ea.first == eb.first) continue;
+        order.push_back(nid);
+    }
+
+    std::sort(order.begin(), order.end());
+
+    std::vector<int64_t> neighbours;
+
+    for (auto nid : order) {
+        neighbours.clear();
+
+        for (auto const& [other, edge] : G.edge(nid)) {
+            neighbours.push_back(other);
+        }
+
+        std::sort(neighbours.begin(), neighbours.end());
+
+        auto& position = G.node(nid).position;
 
-                relax_part(G, ea.first, nid, eb.first);
+        for (auto a : neighbours) {
+            for (auto b : neighbours) {
+                if (a == b) continue;
+
+                position = relax_part(
+                    G.node(a).position, position, G.node(b).position);
             }
         }
     }
@@ -220,6 +248,8 @@ add_voxel_job(Executor&                           executor,
               SimpleGraph const&                  G,
               std::vector<std::shared_ptr<Edge>>& edge_cache) {
     return executor.enqueue([local_edges = std::move(edge_cache), &G]() {
+        TraceZone zone("write edges");
+
         auto local_grid = ByteGrid::create(0.0F);
 
         for (auto const& edge : local_edges) {
@@ -234,7 +264,9 @@ add_voxel_job(Executor&                           executor,
 /// \brief Write all the edges of the flow graph to a voxel grid
 ///
 static ByteGrid::Ptr write_edges_to_volume(SimpleGraph const& G) {
-    Executor executor;
+    TraceZone zone("rasterize");
+
+    auto& executor = shared_executor();
 
     size_t const edge_count = G.edges().size();
 
@@ -276,6 +308,9 @@ static ByteGrid::Ptr write_edges_to_volume(SimpleGraph const& G) {
 
     for (auto& future : future_grids) {
         auto ptr = future.get();
+
+        TraceZone merge_zone("compMax");
+
         // this does g = max(g, other)
         openvdb::tools::compMax(*main_grid, *ptr);
         // Documentation states that these ops always leave the second grid
@@ -288,12 +323,18 @@ static ByteGrid::Ptr write_edges_to_volume(SimpleGraph const& G) {
 void write_mesh_to(SimpleGraph&                 G,
                    SimpleTransform const&       tf,
                    std::filesystem::path const& path) {
+    TraceZone zone("write mesh");
+
     // first prune, this should reduce our load for later steps
     prune(G);
 
+    report_memory("prune", { { "flow graph", G.memory_usage() } });
+
     // relax nodes to reduce harsh bends
     relax(G);
 
+    report_memory("relax", { { "flow graph", G.memory_usage() } });
+
     // voxelize the flow graph. This will use an inflation factor to increase
     // the resolution of the voxel grid to capture fine mesh details.
     // TODO: make the factor automatic
@@ -303,13 +344,21 @@ void write_mesh_to(SimpleGraph&                 G,
 
     fmt::print("Completed output volume.\n");
 
+    report_memory("rasterize",
+                  { { "flow graph", G.memory_usage() },
+                    { "output volume", grid->memUsage() } });
+
     // isosurf the voxel grid
     std::vector<openvdb::Vec3s> position_list;
     std::vector<openvdb::Vec3I> tri_list;
     std::vector<openvdb::Vec4I> quad_list;
 
-    openvdb::tools::volumeToMesh(
-        *grid, position_list, tri_list, quad_list, .9 * 255);
+    {
+        TraceZone mesh_zone("volumeToMesh");
+
+        openvdb::tools::volumeToMesh(
+            *grid, position_list, tri_list, quad_list, .9 * 255);
+    }
 
 
     // we need to do the inverse transform to get back to the input mesh
@@ -326,6 +375,15 @@ void write_mesh_to(SimpleGraph&                 G,
                tri_list.size(),
                quad_list.size());
 
+    size_t const geometry_bytes = vector_bytes(position_list) +
+                                  vector_bytes(tri_list) +
+                                  vector_bytes(quad_list);
+
+    report_memory("isosurface",
+                  { { "flow graph", G.memory_usage() },
+                    { "output volume", grid->memUsage() },
+                    { "output geometry", geometry_bytes } });
+
     fmt::print("Writing geometry to {}\n", path.c_str());
 
     // Dump in .obj format
@@ -350,4 +408,6 @@ void write_mesh_to(SimpleGraph&                 G,
                    << " " << f.z() + 1 << "\n";
         }
     }
+
+    report_memory("write", { { "output geometry", geometry_bytes } });
 }
@@ -0,0 +1,138 @@
+#include "point_index.h"
+
+#include "xrange.h"
+
+#include <algorithm>
+#include <limits>
+
+/// Ranges at or below this size are scanned, instead of split
+constexpr size_t LEAF_SIZE = 8;
+
+PointIndex::PointIndex(std::vector<glm::vec3> const& points)
+    : m_source(points.size()), m_axis(points.size()) {
+
+    for (size_t i : xrange_over(m_source)) {
+        m_source[i] = i;
+    }
+
+    build(points, 0, points.size());
+
+    // gather the points into tree order once the permutation is done
+    m_points.resize(points.size());
+
+    for (size_t i : xrange_over(m_source)) {
+        m_points[i] = points[m_source[i]];
+    }
+}
+
+void PointIndex::build(std::vector<glm::vec3> const& points,
+                       size_t                        begin,
+                       size_t                        end) {
+    if (end - begin <= LEAF_SIZE) return;
+
+    auto const first = m_source.begin() + begin;
+    auto const last  = m_source.begin() + end;
+
+    // split along the widest axis of this range
+    glm::vec3 lower = points[*first];
+    glm::vec3 upper = points[*first];
+
+    for (auto it = first; it != last; ++it) {
+        lower = glm::min(lower, points[*it]);
+        upper = glm::max(upper, points[*it]);
+    }
+
+    auto    extent = upper - lower;
+    uint8_t axis   = 0;
+
+    if (extent.y > extent[axis]) axis = 1;
+    if (extent.z > extent[axis]) axis = 2;
+
+    size_t mid = begin + (end - begin) / 2;
+
+    // partition the permutation in place; points are not moved until the end
+    std::nth_element(first,
+                     m_source.begin() + mid,
+                     last,
+                     [&points, axis](size_t a, size_t b) {
+                         return points[a][axis] < points[b][axis];
+                     });
+
+    m_axis[mid] = axis;
+
+    build(points, begin, mid);
+    build(points, mid + 1, end);
+}
+
+///
+/// \brief Recursive nearest point search over a range of an implicit kd-tree
+///
+static void search(std::vector<glm::vec3> const& points,
+                   std::vector<uint8_t> const&   axes,
+                   size_t                        begin,
+                   size_t                        end,
+                   glm::vec3                     query,
+                   size_t&                       best_index,
+                   float&                        best_distance) {
+
+    if (end - begin <= LEAF_SIZE) {
+        for (size_t i : xrange(begin, end)) {
+            float d = glm::distance2(query, points[i]);
+
+            if (d < best_distance) {
+                best_distance = d;
+                best_index    = i;
+            }
+        }
+        return;
+    }
+
+    size_t mid  = begin + (end - begin) / 2;
+    auto   axis = axes[mid];
+
+    {
+        float d = glm::distance2(query, points[mid]);
+
+        if (d < best_distance) {
+            best_distance = d;
+            best_index    = mid;
+        }
+    }
+
+    float delta = query[axis] - points[mid][axis];
+
+    // descend into the side the query is on first
+    if (delta < 0) {
+        search(points, axes, begin, mid, query, best_index, best_distance);
+
+        if (delta * delta < best_distance) {
+            search(
+                points, axes, mid + 1, end, query, best_index, best_distance);
+        }
+    } else {
+        search(points, axes, mid + 1, end, query, best_index, best_distance);
+
+        if (delta * delta < best_distance) {
+            search(points, axes, begin, mid, query, best_index, best_distance);
+        }
+    }
+}
+
+PointIndex::Nearest PointIndex::nearest(glm::vec3 query) const {
+    size_t best_index    = std::numeric_limits<size_t>::max();
+    float  best_distance = std::numeric_limits<float>::max();
+
+    search(m_points,
+           m_axis,
+           0,
+           m_points.size(),
+           query,
+           best_index,
+           best_distance);
+
+    if (best_index < m_source.size()) {
+        best_index = m_source[best_index];
+    }
+
+    return { best_index, best_distance };
+}
@@ -0,0 +1,47 @@
+#ifndef POINT_INDEX_H
+#define POINT_INDEX_H
+
+#include "glm_include.h"
+
+#include <vector>
+
+///
+/// \brief The PointIndex class is a static kd-tree for nearest point queries
+///
+/// The tree is implicit; points are reordered so that each range is split at
+/// its midpoint, along the widest axis of that range.
+///
+class PointIndex {
+    std::vector<glm::vec3> m_points; ///< Points, in tree order
+    std::vector<size_t>    m_source; ///< Original index of each point
+    std::vector<uint8_t>   m_axis;   ///< Split axis, for each midpoint
+
+    void build(std::vector<glm::vec3> const&, size_t begin, size_t end);
+
+public:
+    ///
+    /// \brief The Nearest struct is the result of a query
+    ///
+    struct Nearest {
+        size_t index;     ///< Index of the point in the source list
+        float  distance2; ///< Squared distance to the point
+    };
+
+    ///
+    /// \brief Build an index over a list of points
+    ///
+    explicit PointIndex(std::vector<glm::vec3> const& points);
+
+    ///
+    /// \brief Find the point closest to the query.
+    ///
+    /// If the index is empty, the distance is the max float and the index is
+    /// invalid.
+    ///
+    [[nodiscard]] Nearest nearest(glm::vec3) const;
+
+    [[nodiscard]] size_t size() const { return m_points.size(); }
+    [[nodiscard]] bool   empty() const { return m_points.empty(); }
+};
+
+#endif // POINT_INDEX_H
@@ -1,14 +1,45 @@
 #include "simplegraph.h"
 
+#include "disjointset.h"
 #include "global.h"
+#include "trace.h"
 
 #include <fmt/printf.h>
 
 #include <cassert>
 #include <optional>
+#include <tuple>
 #include <unordered_set>
 
-SimpleGraph::SimpleGraph() = default;
+/// Size of the first block the arena takes from the system; later blocks grow
+constexpr size_t ARENA_INITIAL_SIZE = 1 << 20;
+
+void* SimpleGraph::CountingResource::do_allocate(size_t bytes,
+                                                 size_t alignment) {
+    m_bytes += bytes;
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+}
+
+void SimpleGraph::CountingResource::do_deallocate(void*  p,
+                                                  size_t bytes,
+                                                  size_t alignment) {
+    m_bytes -= bytes;
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+}
+
+bool SimpleGraph::CountingResource::do_is_equal(
+    memory_resource const& other) const noexcept {
+    return this == &other;
+}
+
+SimpleGraph::SimpleGraph()
+    : m_heap(std::make_unique<CountingResource>()),
+      m_arena(std::make_unique<std::pmr::monotonic_buffer_resource>(
+          ARENA_INITIAL_SIZE, m_heap.get())),
+      m_pool(std::make_unique<std::pmr::unsynchronized_pool_resource>(
+          m_arena.get())),
+      m_nodes(m_pool.get()),
+      m_edges(m_pool.get()) {}
 
 SimpleGraph::~SimpleGraph() = default;
 
@@ -26,7 +57,8 @@ void SimpleGraph::add_edge(int64_t a, int64_t b, EdgeData data) {
 
     if (aiter->second.edges.count(b)) return;
 
-    auto ptr = std::make_shared<Edge>(a, b, data);
+    auto ptr = std::allocate_shared<Edge>(
+        std::pmr::polymorphic_allocator<Edge>(m_pool.get()), a, b, data);
 
     aiter->second.edges.try_emplace(b, ptr);
     biter->second.edges.try_emplace(a, ptr);
@@ -65,8 +97,7 @@ NodeData& SimpleGraph::node(int64_t i) {
     }
 }
 
-std::unordered_map<int64_t, Node::Ptr> const&
-SimpleGraph::edge(int64_t i) const {
+SimpleGraph::EdgeMap const& SimpleGraph::edge(int64_t i) const {
     try {
         return m_nodes.at(i).edges;
     } catch (...) {
@@ -74,55 +105,9 @@ SimpleGraph::edge(int64_t i) const {
     }
 }
 
-struct UnionFind {
-    std::unordered_map<int64_t, int64_t> parents;
-    std::unordered_map<int64_t, float>   weights;
-
-    int64_t operator[](int64_t object) {
-        if (parents.count(object) == 0) {
-            parents[object] = object;
-            weights[object] = 1;
-            return object;
-        }
-
-        std::vector<int64_t> path;
-
-        path.push_back(object);
-
-        auto root = parents.at(object);
-
-        while (root != path.back()) {
-            path.push_back(root);
-            root = parents[root];
-        }
-
-        for (auto ancestor : path) {
-            parents[ancestor] = root;
-        }
-
-        return root;
-    }
-
-    void unioned(int64_t a, int64_t b) {
-        std::array<int64_t, 2> roots = { operator[](a), operator[](b) };
-
-        auto heaviest_iter = std::max_element(
-            roots.begin(), roots.end(), [this](auto a, auto b) {
-                return weights[a] < weights[b];
-            });
-
-        auto heaviest = *heaviest_iter;
-
-        for (auto r : roots) {
-            if (r == heaviest) continue;
-
-            weights[heaviest] += weights[r];
-            parents[r] = heaviest;
-        }
-    }
-};
-
 std::vector<EdgeKey> SimpleGraph::compute_min_spanning_tree() const {
+    TraceZone zone("mst");
+
     std::vector<EdgeKey> ret;
 
     std::vector<Edge> edge_list;
@@ -136,18 +121,29 @@ std::vector<EdgeKey> SimpleGraph::compute_min_spanning_tree() const {
         edge_list.push_back(ne);
     }
 
+    // m_edges is hashed by address, so break ties on the node pair to keep
+    // the tree independent of allocation order
     std::sort(
         edge_list.begin(), edge_list.end(), [](auto const& a, auto const& b) {
-            return a.data.weight < b.data.weight;
+            return std::make_tuple(
+                       a.data.weight, std::min(a.a, a.b), std::max(a.a, a.b)) <
+                   std::make_tuple(
+                       b.data.weight, std::min(b.a, b.b), std::max(b.a, b.b));
         });
 
 
-    UnionFind uf;
+    // union-find works on dense indices
+    std::unordered_map<int64_t, DisjointSet::Index> index_of;
+
+    for (auto const& [nid, ndata] : m_nodes) {
+        index_of.try_emplace(nid, index_of.size());
+    }
+
+    DisjointSet sets(index_of.size());
 
     for (auto const& e : edge_list) {
-        if (uf[e.a] != uf[e.b]) {
+        if (sets.unite(index_of.at(e.a), index_of.at(e.b))) {
             ret.emplace_back(e.a, e.b);
-            uf.unioned(e.a, e.b);
         }
     }
 
@@ -200,68 +196,3 @@ std::unordered_map<int64_t, size_t> SimpleGraph::components() const {
 
     return colors;
 }
-
-
-SimpleTree::SimpleTree(int64_t root) : m_root(root) {}
-
-std::unordered_set<int64_t> const&
-SimpleTree::get_children_of(int64_t i) const {
-    assert(has_node(i) && "Cannot get children of node that doesnt exist");
-    return m_nodes.at(i).out_ids;
-}
-
-size_t recursive_size_check(SimpleTree const& t, int64_t a) {
-    size_t i = 1;
-
-    for (auto oid : t.get_children_of(a)) {
-        i += recursive_size_check(t, oid);
-    }
-
-    return i;
-}
-
-void SimpleTree::add_edge(int64_t a, int64_t b) {
-    // we shouldn't be adding the same edge twice
-    assert(m_nodes[a].out_ids.count(b) == 0);
-
-    m_nodes[a].out_ids.insert(b);
-    m_nodes.try_emplace(b, TNode{});
-}
-
-
-size_t SimpleTree::node_count() const { return m_nodes.size(); }
-
-bool SimpleTree::validate_tree() {
-    std::unordered_set<int64_t> visited;
-
-    auto first = root();
-
-    assert(this->has_node(first));
-
-
-    std::function<bool(int64_t)> recursive_visit = [&](int64_t node) {
-        if (!this->has_node(node)) {
-            fmt::print("Missing node {}\n", node);
-            assert(0);
-        }
-
-        if (visited.count(node)) return false;
-
-        visited.insert(node);
-
-
-        for (auto id : this->get_children_of(node)) {
-            if (!recursive_visit(id)) return false;
-        }
-
-        return true;
-    };
-
-    if (!recursive_visit(first)) return false;
-
-    for (auto const& n : this->nodes()) {
-        if (!visited.count(n.first)) return false;
-    }
-
-    return true;
-}
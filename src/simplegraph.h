@@ -3,6 +3,8 @@
 
 #include "glm_include.h"
 
+#include <memory>
+#include <memory_resource>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -22,15 +24,25 @@ struct NodeData {
 ///
 /// \brief The Node struct holds data and topology information for a node
 ///
+/// Nodes are allocator aware, so that the edge map of a node comes from the
+/// same memory pool as the graph that holds it.
+///
 struct Node {
-    using Ptr = std::shared_ptr<Edge>;
+    using Ptr            = std::shared_ptr<Edge>;
+    using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
 
-    std::unordered_map<int64_t, Ptr> edges;
+    std::pmr::unordered_map<int64_t, Ptr> edges;
 
     NodeData data;
 
-    Node() = default;
-    Node(NodeData d) : data(d) {}
+    explicit Node(allocator_type alloc = {}) : edges(alloc) {}
+    Node(NodeData d, allocator_type alloc = {}) : edges(alloc), data(d) {}
+
+    Node(Node const& other, allocator_type alloc = {})
+        : edges(other.edges, alloc), data(other.data) {}
+    Node(Node&& other, allocator_type alloc)
+        : edges(std::move(other.edges), alloc), data(other.data) {}
+    Node(Node&&) = default;
 };
 
 
@@ -97,15 +109,47 @@ struct hash<EdgeKey> {
 ///
 /// \brief The SimpleGraph class is a super simple undirected graph
 ///
+/// All nodes, edges and their maps are allocated from a memory pool owned by
+/// the graph. Removed nodes and edges go back to the pool's free lists, and
+/// the pool gets new memory in large blocks from an arena. Everything is
+/// released at once when the graph is destroyed. The pool is not thread safe,
+/// so a graph must only be modified from one thread at a time.
+///
 class SimpleGraph {
-    using EdgeMap = std::unordered_map<int64_t, Node::Ptr>;
-    std::unordered_map<int64_t, Node>         m_nodes;
-    std::unordered_set<std::shared_ptr<Edge>> m_edges;
+    using EdgeMap = std::pmr::unordered_map<int64_t, Node::Ptr>;
+
+    ///
+    /// \brief The CountingResource class takes memory from the heap, and
+    /// keeps a total of the bytes it hands out.
+    ///
+    class CountingResource : public std::pmr::memory_resource {
+        size_t m_bytes = 0;
+
+        void* do_allocate(size_t bytes, size_t alignment) override;
+        void  do_deallocate(void*, size_t bytes, size_t alignment) override;
+        bool  do_is_equal(memory_resource const&) const noexcept override;
+
+    public:
+        [[nodiscard]] size_t bytes() const { return m_bytes; }
+    };
+
+    // declared first, so they are destroyed after the containers using them
+    std::unique_ptr<CountingResource>                       m_heap;
+    std::unique_ptr<std::pmr::monotonic_buffer_resource>    m_arena;
+    std::unique_ptr<std::pmr::unsynchronized_pool_resource> m_pool;
+
+    std::pmr::unordered_map<int64_t, Node>         m_nodes;
+    std::pmr::unordered_set<std::shared_ptr<Edge>> m_edges;
 
 public:
     SimpleGraph();
     ~SimpleGraph();
 
+    // containers keep pointing at the pool they were built with, so a graph
+    // may be moved, but not assigned over
+    SimpleGraph(SimpleGraph&&) = default;
+    SimpleGraph& operator=(SimpleGraph&&) = delete;
+
     ///
     /// \brief Add a node to the graph
     ///
@@ -157,69 +201,12 @@ public:
     /// \brief Get the number of edges
     [[nodiscard]] size_t edge_count() const;
 
+    /// \brief Get the bytes the graph has taken from the heap
+    [[nodiscard]] size_t memory_usage() const { return m_heap->bytes(); }
+
     /// \brief Get connected components
     /// \return A map from node to component number
     [[nodiscard]] std::unordered_map<int64_t, size_t> components() const;
 };
 
-///
-/// \brief The SimpleTree class models a tree.
-///
-/// We use a node list approach so we can add edges at random
-///
-class SimpleTree {
-    using EdgeSet = std::unordered_set<int64_t>;
-
-    ///
-    /// \brief The TNode struct is a node in a tree
-    ///
-    struct TNode {
-        int64_t id;
-
-        EdgeSet out_ids;
-    };
-
-    using NodeMap = std::unordered_map<int64_t, TNode>;
-
-    /// The root of the tree
-    int64_t m_root = -1;
-    NodeMap m_nodes;
-
-public:
-    ///
-    /// \brief Create a new tree with a given node as the root
-    ///
-    SimpleTree(int64_t root);
-
-    [[nodiscard]] int64_t root() const { return m_root; }
-
-    /// \brief Get the downstream nodes of a node
-    [[nodiscard]] EdgeSet const& get_children_of(int64_t) const;
-
-    ///
-    /// \brief Add a directed edge from one node to another
-    ///
-    /// Will create nodes as needed. Will explode if you add the same edge
-    /// twice.
-    ///
-    void add_edge(int64_t, int64_t);
-
-    /// \brief Ask if a node exists in the tree
-    bool has_node(int64_t n) const { return m_nodes.count(n) > 0; }
-
-    /// \brief Get all nodes as a map
-    [[nodiscard]] auto const& nodes() const { return m_nodes; }
-
-    [[nodiscard]] auto begin() const { return m_nodes.begin(); }
-    [[nodiscard]] auto end() const { return m_nodes.end(); }
-
-    /// \brief Get the count of nodes in the tree
-    [[nodiscard]] size_t node_count() const;
-
-    /// \brief Ensure the tree is consistent, due to our choice of data
-    /// structure.
-    bool validate_tree();
-};
-
-
 #endif // SIMPLEGRAPH_H
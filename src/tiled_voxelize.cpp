@@ -0,0 +1,561 @@
+#include "tiled_voxelize.h"
+
+#include "global.h"
+#include "jobcontroller.h"
+#include "trace.h"
+#include "wavefrontimport.h"
+#include "xrange.h"
+
+#include <fmt/printf.h>
+
+#include <openvdb/tools/Dense.h>
+#include <openvdb/tools/MeshToVolume.h>
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+/// Voxels of triangles kept around a brick, so distances near its faces see
+/// every triangle that can reach them
+constexpr int HALO = 2;
+
+/// Estimated working set per brick voxel: the dense brick, the inside flags,
+/// and room for the distance band
+constexpr size_t BYTES_PER_BRICK_VOXEL = 8;
+
+/// Estimated working set per brick voxel column, for the one mesh being
+/// folded in: a crossing offset, the parity above, and room for a few
+/// crossings
+constexpr size_t BYTES_PER_BRICK_COLUMN =
+    sizeof(uint32_t) + sizeof(uint8_t) + 4 * sizeof(float);
+
+///
+/// \brief The FaceSubset class adapts some of the faces of a mesh to the
+/// OpenVDB mesh adapter concept
+///
+class FaceSubset {
+    MutableMesh const&           m_mesh;
+    std::vector<uint32_t> const& m_faces;
+
+public:
+    FaceSubset(MutableMesh const& mesh, std::vector<uint32_t> const& faces)
+        : m_mesh(mesh), m_faces(faces) {}
+
+    size_t polygonCount() const { return m_faces.size(); }
+    size_t pointCount() const { return 0; }
+    size_t vertexCount(size_t) const { return 3; }
+
+    void getIndexSpacePoint(size_t n, size_t v, openvdb::Vec3d& pos) const {
+        m_mesh.getIndexSpacePoint(m_faces[n], v, pos);
+    }
+};
+
+///
+/// \brief The FaceRange struct is a view of some face indices of a mesh
+///
+struct FaceRange {
+    uint32_t const* first = nullptr;
+    uint32_t const* last  = nullptr;
+
+    [[nodiscard]] uint32_t const* begin() const { return first; }
+    [[nodiscard]] uint32_t const* end() const { return last; }
+};
+
+///
+/// \brief Get the edge length of a brick, in voxels, for the memory budget of
+/// one brick. Bricks are a multiple of the leaf size, so no leaf spans two
+/// bricks.
+///
+static int brick_edge(size_t budget_bytes) {
+    auto edge = static_cast<int>(
+        std::cbrt(static_cast<double>(budget_bytes) / BYTES_PER_BRICK_VOXEL));
+
+    edge = edge / 8 * 8;
+
+    auto working_set = [](size_t e) {
+        return e * e * (e * BYTES_PER_BRICK_VOXEL + BYTES_PER_BRICK_COLUMN);
+    };
+
+    while (edge > 16 && working_set(edge) > budget_bytes) {
+        edge -= 8;
+    }
+
+    return std::max(16, edge);
+}
+
+static glm::dvec3 face_point(MutableMesh const& mesh, uint32_t face, int v) {
+    auto p = mesh.vertex()[mesh.faces()[face].indicies[v]].position;
+    return glm::dvec3(p);
+}
+
+///
+/// \brief Ask if an edge claims points exactly on it, using the top-left
+/// rule. Of two triangles sharing an edge, exactly one claims it.
+///
+static bool edge_claims(glm::dvec3 p, glm::dvec3 q, double weight) {
+    if (weight != 0) return weight > 0;
+
+    auto d = q - p;
+    return d.y < 0 || (d.y == 0 && d.x < 0);
+}
+
+///
+/// \brief Find the height at which the vertical line through (x, y) crosses
+/// a triangle, if it does.
+///
+static std::optional<double>
+crossing(glm::dvec3 a, glm::dvec3 b, glm::dvec3 c, double x, double y) {
+    double area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+
+    if (area == 0) return std::nullopt;
+
+    // wind counter clockwise, as seen from above
+    if (area < 0) {
+        std::swap(b, c);
+        area = -area;
+    }
+
+    auto weight = [x, y](glm::dvec3 p, glm::dvec3 q) {
+        return (q.x - p.x) * (y - p.y) - (q.y - p.y) * (x - p.x);
+    };
+
+    double wa = weight(b, c);
+    double wb = weight(c, a);
+    double wc = weight(a, b);
+
+    if (!edge_claims(b, c, wa) || !edge_claims(c, a, wb) ||
+        !edge_claims(a, b, wc)) {
+        return std::nullopt;
+    }
+
+    return (wa * a.z + wb * b.z + wc * c.z) / area;
+}
+
+///
+/// \brief The Brick struct describes the voxels of one brick, and maps them
+/// to flat indices, z fastest
+///
+struct Brick {
+    openvdb::CoordBBox box;
+
+    [[nodiscard]] openvdb::Coord dim() const { return box.dim(); }
+
+    [[nodiscard]] size_t column(int x, int y) const {
+        return size_t(x - box.min().x()) * dim().y() + (y - box.min().y());
+    }
+
+    [[nodiscard]] size_t index(int x, int y, int z) const {
+        return column(x, y) * dim().z() + (z - box.min().z());
+    }
+};
+
+///
+/// \brief The ColumnCrossings struct holds where one mesh crosses the voxel
+/// columns of a brick.
+///
+/// Heights within the brick are kept sorted, in one array for all columns;
+/// crossings above the brick only matter for their parity.
+///
+struct ColumnCrossings {
+    std::vector<uint32_t> offsets;      ///< Column start in heights, and end
+    std::vector<float>    heights;      ///< Heights, by column
+    std::vector<uint8_t>  parity_above; ///< Crossing parity above the brick
+};
+
+///
+/// \brief Compute the crossings of every voxel column of a brick, for one
+/// mesh.
+///
+static ColumnCrossings brick_crossings(MutableMesh const& mesh,
+                                       FaceRange          faces,
+                                       Brick const&       brick) {
+    auto const lo = brick.box.min();
+    auto const hi = brick.box.max();
+
+    size_t const column_count = size_t(brick.dim().x()) * brick.dim().y();
+
+    ColumnCrossings ret;
+    ret.offsets.assign(column_count + 1, 0);
+    ret.parity_above.assign(column_count, 0);
+
+    std::vector<std::pair<uint32_t, float>> found;
+
+    for (uint32_t face : faces) {
+        auto a = face_point(mesh, face, 0);
+        auto b = face_point(mesh, face, 1);
+        auto c = face_point(mesh, face, 2);
+
+        auto fmin = glm::min(a, glm::min(b, c));
+        auto fmax = glm::max(a, glm::max(b, c));
+
+        // crossings at or below the bottom of the brick are never above a
+        // voxel of it
+        if (fmax.z <= lo.z()) continue;
+
+        int x0 = std::max(lo.x(), static_cast<int>(std::ceil(fmin.x)));
+        int x1 = std::min(hi.x(), static_cast<int>(std::floor(fmax.x)));
+        int y0 = std::max(lo.y(), static_cast<int>(std::ceil(fmin.y)));
+        int y1 = std::min(hi.y(), static_cast<int>(std::floor(fmax.y)));
+
+        for (int x = x0; x <= x1; x++) {
+            for (int y = y0; y <= y1; y++) {
+                auto z = crossing(a, b, c, x, y);
+
+                if (!z) continue;
+
+                // classify at the stored precision
+                auto height = static_cast<float>(*z);
+
+                if (height <= lo.z()) continue;
+
+                auto col = static_cast<uint32_t>(brick.column(x, y));
+
+                if (height > hi.z()) {
+                    ret.parity_above[col] ^= 1;
+                } else {
+                    found.emplace_back(col, height);
+                }
+            }
+        }
+    }
+
+    // bucket the heights by column
+    for (auto const& [col, z] : found) {
+        ret.offsets[col + 1]++;
+    }
+
+    for (size_t i : xrange(column_count)) {
+        ret.offsets[i + 1] += ret.offsets[i];
+    }
+
+    ret.heights.resize(found.size());
+
+    {
+        auto next = ret.offsets;
+
+        for (auto const& [col, z] : found) {
+            ret.heights[next[col]++] = z;
+        }
+    }
+
+    parallel_for(column_count, 1024, [&](size_t begin, size_t end) {
+        for (size_t i : xrange(begin, end)) {
+            std::sort(ret.heights.begin() + ret.offsets[i],
+                      ret.heights.begin() + ret.offsets[i + 1]);
+        }
+    });
+
+    return ret;
+}
+
+///
+/// \brief Mark the voxels of a brick that are inside one mesh
+///
+static void mark_inside(MutableMesh const&           mesh,
+                        std::vector<uint32_t> const& faces,
+                        ColumnCrossings const&       crossings,
+                        Brick const&                 brick,
+                        std::vector<uint8_t>&        inside) {
+    auto const lo = brick.box.min();
+    auto const hi = brick.box.max();
+
+    std::fill(inside.begin(), inside.end(), 0);
+
+    // an odd number of crossings above a voxel puts it inside
+    parallel_for(size_t(brick.dim().x()), 1, [&](size_t begin, size_t end) {
+        for (size_t dx : xrange(begin, end)) {
+            int x = lo.x() + static_cast<int>(dx);
+
+            for (int y = lo.y(); y <= hi.y(); y++) {
+                size_t const col = brick.column(x, y);
+
+                auto const& heights = crossings.heights;
+
+                auto const first = heights.begin() + crossings.offsets[col];
+                auto const last = heights.begin() + crossings.offsets[col + 1];
+
+                size_t const parity = crossings.parity_above[col];
+
+                auto above = first;
+
+                for (int z = lo.z(); z <= hi.z(); z++) {
+                    while (above != last && *above <= z) {
+                        ++above;
+                    }
+
+                    if ((size_t(last - above) + parity) % 2 == 1) {
+                        inside[brick.index(x, y, z)] = 1;
+                    }
+                }
+            }
+        }
+    });
+
+    if (faces.empty()) return;
+
+    // voxels within half a voxel of the surface are inside, too
+    auto distance = openvdb::tools::meshToVolume<openvdb::FloatGrid>(
+        FaceSubset(mesh, faces),
+        {},
+        1.0F,
+        1.0F,
+        openvdb::tools::UNSIGNED_DISTANCE_FIELD);
+
+    for (auto iter = distance->cbeginValueOn(); iter; ++iter) {
+        if (*iter >= .5F) continue;
+
+        openvdb::CoordBBox box;
+        iter.getBoundingBox(box);
+        box.intersect(brick.box);
+
+        for (int x = box.min().x(); x <= box.max().x(); x++) {
+            for (int y = box.min().y(); y <= box.max().y(); y++) {
+                for (int z = box.min().z(); z <= box.max().z(); z++) {
+                    inside[brick.index(x, y, z)] = 1;
+                }
+            }
+        }
+    }
+}
+
+///
+/// \brief Collect the faces of a mesh whose bounds, grown by the halo, touch
+/// a box
+///
+static std::vector<uint32_t> faces_near(MutableMesh const&        mesh,
+                                        FaceRange                 faces,
+                                        openvdb::CoordBBox const& box) {
+    std::vector<uint32_t> near;
+
+    auto lo = glm::dvec3(box.min().x(), box.min().y(), box.min().z()) -
+              glm::dvec3(HALO);
+    auto hi = glm::dvec3(box.max().x(), box.max().y(), box.max().z()) +
+              glm::dvec3(HALO);
+
+    for (uint32_t face : faces) {
+        auto a = face_point(mesh, face, 0);
+        auto b = face_point(mesh, face, 1);
+        auto c = face_point(mesh, face, 2);
+
+        auto fmin = glm::min(a, glm::min(b, c));
+        auto fmax = glm::max(a, glm::max(b, c));
+
+        bool overlaps = fmin.x <= hi.x && fmin.y <= hi.y && fmin.z <= hi.z &&
+                        fmax.x >= lo.x && fmax.y >= lo.y && fmax.z >= lo.z;
+
+        if (overlaps) {
+            near.push_back(face);
+        }
+    }
+
+    return near;
+}
+
+///
+/// \brief The SlabBins struct holds the faces of every mesh near each brick
+/// column of one slab, in one array
+///
+struct SlabBins {
+    size_t                mesh_count = 0;
+    std::vector<size_t>   offsets; ///< Start of each column and mesh bin
+    std::vector<uint32_t> faces;   ///< Face indices, by bin
+
+    [[nodiscard]] FaceRange of(int by, size_t mi) const {
+        size_t bin = size_t(by) * mesh_count + mi;
+        return { faces.data() + offsets[bin], faces.data() + offsets[bin + 1] };
+    }
+};
+
+///
+/// \brief Bin the faces of all meshes by the brick columns of a slab that
+/// their bounds, grown by the halo, touch.
+///
+/// Faces are visited twice, to count and then to fill, so only this slab's
+/// bins are ever held.
+///
+static SlabBins bin_slab(std::vector<MutableMesh const*> const& meshes,
+                         int                                    bx,
+                         int                                    edge,
+                         openvdb::Coord                         bricks) {
+    TraceZone zone("bin slab");
+
+    SlabBins bins;
+    bins.mesh_count = meshes.size();
+    bins.offsets.assign(size_t(bricks.y()) * meshes.size() + 1, 0);
+
+    auto to_brick = [edge](double v, int count) {
+        return std::clamp(static_cast<int>(std::floor(v / edge)), 0, count - 1);
+    };
+
+    // visit the columns of this slab that each face touches
+    auto for_each_bin = [&](auto&& f) {
+        for (size_t mi : xrange(meshes.size())) {
+            auto const& mesh = *meshes[mi];
+
+            for (uint32_t face : xrange(uint32_t(mesh.faces().size()))) {
+                auto a = face_point(mesh, face, 0);
+                auto b = face_point(mesh, face, 1);
+                auto c = face_point(mesh, face, 2);
+
+                auto fmin = glm::min(a, glm::min(b, c)) - glm::dvec3(HALO);
+                auto fmax = glm::max(a, glm::max(b, c)) + glm::dvec3(HALO);
+
+                if (bx < to_brick(fmin.x, bricks.x()) ||
+                    bx > to_brick(fmax.x, bricks.x())) {
+                    continue;
+                }
+
+                for (int by = to_brick(fmin.y, bricks.y());
+                     by <= to_brick(fmax.y, bricks.y());
+                     by++) {
+                    f(size_t(by) * meshes.size() + mi, face);
+                }
+            }
+        }
+    };
+
+    for_each_bin([&](size_t bin, uint32_t) { bins.offsets[bin + 1]++; });
+
+    for (size_t i : xrange(bins.offsets.size() - 1)) {
+        bins.offsets[i + 1] += bins.offsets[i];
+    }
+
+    bins.faces.resize(bins.offsets.back());
+
+    auto next = bins.offsets;
+
+    for_each_bin(
+        [&](size_t bin, uint32_t face) { bins.faces[next[bin]++] = face; });
+
+    return bins;
+}
+
+///
+/// \brief Voxelize one brick, folding every mesh into it
+/// \return A mask of the voxels of the brick that are inside
+///
+static openvdb::MaskGrid::Ptr
+voxelize_brick(std::vector<MutableMesh const*> const& meshes,
+               SlabBins const&                        bins,
+               int                                    by,
+               Brick const&                           brick,
+               bool                                   is_union) {
+    TraceZone zone("brick");
+
+    // start from the combination of no meshes, then fold each mesh in: a
+    // union only turns voxels in, an intersection only turns voxels out
+    openvdb::tools::Dense<float> dense(brick.box, is_union ? 0.0F : 1.0F);
+
+    std::vector<uint8_t> inside(brick.box.volume());
+
+    // fold meshes in one at a time, so only one mesh's crossings are alive
+    for (size_t mi : xrange(meshes.size())) {
+        auto faces = bins.of(by, mi);
+
+        auto crossings = brick_crossings(*meshes[mi], faces, brick);
+
+        auto near = faces_near(*meshes[mi], faces, brick.box);
+
+        mark_inside(*meshes[mi], near, crossings, brick, inside);
+
+        for (auto ijk = brick.box.begin(); ijk; ++ijk) {
+            auto const& c = *ijk;
+
+            bool in = inside[brick.index(c.x(), c.y(), c.z())];
+
+            if (is_union && in) {
+                dense.setValue(c, 1.0F);
+            } else if (!is_union && !in) {
+                dense.setValue(c, 0.0F);
+            }
+        }
+    }
+
+    // only the inside voxels differ from the background
+    auto piece = openvdb::FloatGrid::create(0.0F);
+
+    openvdb::tools::copyFromDense(dense, *piece, 0.0F);
+
+    auto mask = openvdb::MaskGrid::create();
+    mask->topologyUnion(*piece);
+
+    return mask;
+}
+
+openvdb::MaskGrid::Ptr
+voxelize_tiled(std::vector<MutableObject> const& objects,
+               openvdb::Coord                    resolution,
+               size_t                            budget_bytes) {
+
+    TraceZone zone("tiled voxelize");
+
+    std::vector<MutableMesh const*> meshes;
+
+    for (auto const& o : objects) {
+        for (auto const& m : o.meshes) {
+            meshes.push_back(&m);
+        }
+    }
+
+    bool const is_union =
+        global_configuration().mesh_combine == MeshCombine::UNION;
+
+    // every worker holds one brick's working set at a time
+    size_t const workers = shared_executor().size();
+
+    int const edge = brick_edge(budget_bytes / std::max<size_t>(workers, 1));
+
+    openvdb::CoordBBox const whole(openvdb::Coord(0), resolution);
+
+    openvdb::Coord const bricks(resolution.x() / edge + 1,
+                                resolution.y() / edge + 1,
+                                resolution.z() / edge + 1);
+
+    fmt::print("Tiled voxelization: {} x {} x {} bricks of {} voxels, {} at "
+               "a time\n",
+               bricks.x(),
+               bricks.y(),
+               bricks.z(),
+               edge,
+               workers);
+
+    auto brick_box = [&](int bx, int by, int bz) {
+        openvdb::Coord lo(bx * edge, by * edge, bz * edge);
+        openvdb::CoordBBox box(lo, lo.offsetBy(edge - 1));
+        box.intersect(whole);
+        return box;
+    };
+
+    auto interior = openvdb::MaskGrid::create();
+
+    std::mutex interior_mutex;
+
+    size_t const slab_bricks = size_t(bricks.y()) * bricks.z();
+
+    for (int bx = 0; bx < bricks.x(); bx++) {
+        auto const bins = bin_slab(meshes, bx, edge, bricks);
+
+        // the bricks of a slab are independent; loops inside them run inline
+        parallel_for(slab_bricks, 1, [&](size_t begin, size_t end) {
+            for (size_t i : xrange(begin, end)) {
+                int by = static_cast<int>(i / bricks.z());
+                int bz = static_cast<int>(i % bricks.z());
+
+                Brick brick { brick_box(bx, by, bz) };
+
+                auto piece =
+                    voxelize_brick(meshes, bins, by, brick, is_union);
+
+                std::scoped_lock lock(interior_mutex);
+
+                interior->topologyUnion(*piece);
+            }
+        });
+
+        fmt::print("Voxelized brick slab {} of {}\n", bx + 1, bricks.x());
+    }
+
+    return interior;
+}
@@ -0,0 +1,31 @@
+#ifndef TILED_VOXELIZE_H
+#define TILED_VOXELIZE_H
+
+#include <openvdb/openvdb.h>
+
+#include <vector>
+
+struct MutableObject;
+
+///
+/// \brief Voxelize meshes brick by brick, within a memory budget.
+///
+/// The box from the origin to the resolution is cut into cubic bricks, sized
+/// so the working sets of the bricks in flight, one per worker thread, fit in
+/// the budget. Each brick sees only the triangles near it. Inside and outside
+/// come from counting, per voxel column, the triangles crossed above each
+/// voxel; voxels within half a voxel of a triangle are also inside. Meshes
+/// are folded into a brick one at a time, and combined as in the untiled
+/// path, by mesh_combine. Faces are binned one slab of bricks at a time, and
+/// finished bricks are merged into the result.
+///
+/// Meshes must already be in grid index space, and should be closed.
+///
+/// \return A mask of the voxels inside
+///
+openvdb::MaskGrid::Ptr
+voxelize_tiled(std::vector<MutableObject> const& objects,
+               openvdb::Coord                    resolution,
+               size_t                            budget_bytes);
+
+#endif // TILED_VOXELIZE_H
@@ -0,0 +1,133 @@
+#include "trace.h"
+
+#include "global.h"
+
+#include <fmt/ostream.h>
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+bool trace_detail::enabled = false;
+
+struct Event {
+    char const*                     name;
+    trace_detail::Clock::time_point start;
+    trace_detail::Clock::time_point end;
+};
+
+///
+/// \brief The ThreadEvents struct holds the zones recorded by one thread.
+///
+/// Buffers are owned by the registry, not the thread. All parallel work runs
+/// on the shared executor, so each worker keeps one row for the whole run.
+///
+struct ThreadEvents {
+    size_t             thread;
+    bool               is_main;
+    std::vector<Event> events;
+};
+
+struct Registry {
+    std::mutex                                 mutex;
+    std::vector<std::unique_ptr<ThreadEvents>> threads;
+    trace_detail::Clock::time_point            epoch;
+    std::thread::id                            main_thread;
+};
+
+static Registry& registry() {
+    static Registry r;
+    return r;
+}
+
+static ThreadEvents& local_events() {
+    thread_local ThreadEvents* local = nullptr;
+
+    if (!local) {
+        auto& r = registry();
+
+        std::scoped_lock lock(r.mutex);
+
+        auto& added = r.threads.emplace_back(std::make_unique<ThreadEvents>());
+
+        added->thread  = r.threads.size();
+        added->is_main = std::this_thread::get_id() == r.main_thread;
+
+        local = added.get();
+    }
+
+    return *local;
+}
+
+static double to_microseconds(trace_detail::Clock::duration d) {
+    return std::chrono::duration<double, std::micro>(d).count();
+}
+
+void trace_detail::record(char const*       name,
+                          Clock::time_point start,
+                          Clock::time_point end) {
+    local_events().events.push_back({ name, start, end });
+}
+
+void start_trace() {
+    auto& r = registry();
+
+    r.epoch       = trace_detail::Clock::now();
+    r.main_thread = std::this_thread::get_id();
+
+    trace_detail::enabled = true;
+}
+
+void write_trace(std::filesystem::path const& path) {
+    if (!trace_detail::enabled) return;
+
+    auto& r = registry();
+
+    std::scoped_lock lock(r.mutex);
+
+    std::ofstream stream(path);
+
+    if (!stream.good()) {
+        fatal("Unable to open trace file!");
+    }
+
+    size_t event_count = 0;
+
+    stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+    bool first = true;
+
+    for (auto const& thread : r.threads) {
+        if (!first) stream << ",\n";
+        first = false;
+
+        fmt::print(stream,
+                   R"({{"ph":"M","pid":1,"tid":{},"name":"thread_name",)"
+                   R"("args":{{"name":"{} {}"}}}})",
+                   thread->thread,
+                   thread->is_main ? "main" : "worker",
+                   thread->thread);
+
+        for (auto const& e : thread->events) {
+            fmt::print(stream,
+                       ",\n"
+                       R"({{"ph":"X","pid":1,"tid":{},"name":"{}",)"
+                       R"("ts":{:.3f},"dur":{:.3f}}})",
+                       thread->thread,
+                       e.name,
+                       to_microseconds(e.start - r.epoch),
+                       to_microseconds(e.end - e.start));
+        }
+
+        event_count += thread->events.size();
+    }
+
+    stream << "\n]}\n";
+
+    fmt::print("Wrote {} trace zones from {} threads to {}\n",
+               event_count,
+               r.threads.size(),
+               path.c_str());
+}
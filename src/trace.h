@@ -0,0 +1,61 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <chrono>
+#include <filesystem>
+
+namespace trace_detail {
+
+/// Set once at startup, before any workers exist; read only afterwards
+extern bool enabled;
+
+using Clock = std::chrono::steady_clock;
+
+void record(char const* name, Clock::time_point start, Clock::time_point end);
+
+} // namespace trace_detail
+
+///
+/// \brief The TraceZone class marks a scope as a zone on the trace timeline.
+///
+/// The zone starts at construction and ends at destruction, and is recorded
+/// against the calling thread. The name must outlive the program, like a
+/// string literal, and need no JSON escaping. When tracing is off, a zone is
+/// a single flag check.
+///
+class TraceZone {
+    char const*                     m_name = nullptr;
+    trace_detail::Clock::time_point m_start;
+
+public:
+    explicit TraceZone(char const* name) {
+        if (!trace_detail::enabled) return;
+
+        m_name  = name;
+        m_start = trace_detail::Clock::now();
+    }
+
+    ~TraceZone() {
+        if (!m_name) return;
+
+        trace_detail::record(m_name, m_start, trace_detail::Clock::now());
+    }
+
+    TraceZone(TraceZone const&) = delete;
+    TraceZone& operator=(TraceZone const&) = delete;
+};
+
+///
+/// \brief Start recording zones. Must be called before any worker threads
+/// are started.
+///
+void start_trace();
+
+///
+/// \brief Write all recorded zones as a Chrome trace JSON file, which can be
+/// opened with chrome://tracing or Perfetto. Must be called once all parallel
+/// work has finished.
+///
+void write_trace(std::filesystem::path const&);
+
+#endif // TRACE_H
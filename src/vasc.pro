@@ -22,13 +22,25 @@ macx {
 }
 
 HEADERS += \
+    border_points.h \
+    boruvka.h \
     boundingbox.h \
+    checkpoint.h \
+    counter_random.h \
+    csrgraph.h \
+    disjointset.h \
+    distance_transform.h \
+    flat_tree.h \
+    flow_graph_file.h \
     generate_vessels.h \
     glm_include.h \
     global.h \
     jobcontroller.h \
+    memory_report.h \
+    mesh_soup.h \
     mesh_write.h \
     mutable_mesh.h \
+    point_index.h \
     simplegraph.h \
     third_party/fmt/fmt/chrono.h \
     third_party/fmt/fmt/color.h \
@@ -42,20 +54,34 @@ HEADERS += \
     third_party/fmt/fmt/printf.h \
     third_party/fmt/fmt/ranges.h \
     third_party/fmt/fmt/safe-duration-cast.h \
+    tiled_voxelize.h \
+    trace.h \
+    voxel_blocks.h \
     voxelmesh.h \
     wavefrontimport.h \
     xrange.h
 
 SOURCES += \
+    border_points.cpp \
     boundingbox.cpp \
+    checkpoint.cpp \
+    csrgraph.cpp \
+    distance_transform.cpp \
+    flat_tree.cpp \
+    flow_graph_file.cpp \
     generate_vessels.cpp \
     global.cpp \
     jobcontroller.cpp \
     main.cpp \
+    memory_report.cpp \
+    mesh_soup.cpp \
     mesh_write.cpp \
     mutable_mesh.cpp \
+    point_index.cpp \
     simplegraph.cpp \
     third_party/fmt/src/format.cc \
     third_party/fmt/src/posix.cc \
+    tiled_voxelize.cpp \
+    trace.cpp \
     voxelmesh.cpp \
     wavefrontimport.cpp
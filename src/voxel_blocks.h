@@ -0,0 +1,137 @@
+#ifndef VOXEL_BLOCKS_H
+#define VOXEL_BLOCKS_H
+
+#include "jobcontroller.h"
+#include "xrange.h"
+
+#include <openvdb/openvdb.h>
+
+#include <algorithm>
+#include <vector>
+
+///
+/// \brief The VoxelBlocks class splits the active voxels of a grid into
+/// blocks, for parallel iteration.
+///
+/// Each leaf node is a block. Active tiles are cut into leaf sized blocks, so
+/// no block is larger than a leaf. Empty space is never visited, and values
+/// are read straight from leaves and tiles, without accessor lookups.
+///
+/// Blocks are numbered in tree order, leaves first, then tiles. Work gathered
+/// per block can thus be merged in an order that does not depend on the
+/// number of threads.
+///
+template <class GridType>
+class VoxelBlocks {
+public:
+    using TreeType  = typename GridType::TreeType;
+    using LeafType  = typename TreeType::LeafNodeType;
+    using ValueType = typename GridType::ValueType;
+
+private:
+    struct Block {
+        LeafType const*    leaf = nullptr; ///< Leaf, or null for a tile part
+        openvdb::CoordBBox box;            ///< Region of a tile part
+        ValueType          value {};       ///< Value of a tile part
+    };
+
+    std::vector<Block> m_blocks;
+
+public:
+    ///
+    /// \brief Collect the blocks of a grid
+    ///
+    /// \param grid Grid to collect from; must outlive this object
+    /// \param keep_tile Function, of signature (ValueType) -> bool. Active
+    /// tiles with values failing this are skipped entirely.
+    ///
+    template <class Predicate>
+    VoxelBlocks(GridType const& grid, Predicate keep_tile) {
+        for (auto iter = grid.tree().cbeginLeaf(); iter; ++iter) {
+            Block b;
+            b.leaf = iter.getLeaf();
+            m_blocks.push_back(b);
+        }
+
+        constexpr int32_t DIM = LeafType::DIM;
+
+        auto iter = grid.tree().cbeginValueOn();
+        iter.setMaxDepth(decltype(iter)::LEAF_DEPTH - 1);
+
+        for (; iter; ++iter) {
+            if (!keep_tile(iter.getValue())) continue;
+
+            openvdb::CoordBBox tile;
+            iter.getBoundingBox(tile);
+
+            auto const& l = tile.min();
+            auto const& h = tile.max();
+
+            for (int32_t x = l.x(); x <= h.x(); x += DIM) {
+                for (int32_t y = l.y(); y <= h.y(); y += DIM) {
+                    for (int32_t z = l.z(); z <= h.z(); z += DIM) {
+                        openvdb::Coord lo(x, y, z);
+                        openvdb::Coord hi = openvdb::Coord::minComponent(
+                            lo.offsetBy(DIM - 1), h);
+
+                        Block b;
+                        b.box   = openvdb::CoordBBox(lo, hi);
+                        b.value = iter.getValue();
+                        m_blocks.push_back(b);
+                    }
+                }
+            }
+        }
+    }
+
+    /// \brief Collect the blocks of a grid, including all active tiles
+    explicit VoxelBlocks(GridType const& grid)
+        : VoxelBlocks(grid, [](ValueType const&) { return true; }) {}
+
+    /// \brief Get the number of blocks
+    [[nodiscard]] size_t size() const { return m_blocks.size(); }
+
+    ///
+    /// \brief Execute a function over all active voxels of the blocks, in
+    /// parallel.
+    ///
+    /// The voxels of a block are visited in order, on one thread. Each job
+    /// works on its own copy of the function, so it may carry state that is
+    /// not thread safe, like a grid accessor.
+    ///
+    /// \param f Function, of signature
+    /// (size_t block, openvdb::Coord, ValueType) -> void
+    ///
+    template <class Function>
+    void for_each(Function const& f) const {
+        constexpr size_t BLOCKS_PER_JOB = 64;
+
+        parallel_for(size(), BLOCKS_PER_JOB, [&](size_t begin, size_t end) {
+            Function local = f;
+
+            for (size_t bi : xrange(begin, end)) {
+                auto const& b = m_blocks[bi];
+
+                if (b.leaf) {
+                    for (auto iter = b.leaf->cbeginValueOn(); iter; ++iter) {
+                        local(bi, iter.getCoord(), iter.getValue());
+                    }
+                    continue;
+                }
+
+                auto const& l = b.box.min();
+                auto const& h = b.box.max();
+
+                for (int32_t x : xrange(l.x(), h.x() + 1)) {
+                    for (int32_t y : xrange(l.y(), h.y() + 1)) {
+                        for (int32_t z : xrange(l.z(), h.z() + 1)) {
+                            local(bi, openvdb::Coord(x, y, z), b.value);
+                        }
+                    }
+                }
+            }
+        });
+    }
+};
+
+#endif // VOXEL_BLOCKS_H
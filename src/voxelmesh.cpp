@@ -1,6 +1,10 @@
 #include "voxelmesh.h"
 
+#include "global.h"
 #include "jobcontroller.h"
+#include "mesh_soup.h"
+#include "tiled_voxelize.h"
+#include "trace.h"
 #include "wavefrontimport.h"
 #include "xrange.h"
 
@@ -8,7 +12,9 @@
 
 #include <openvdb/openvdb.h>
 #include <openvdb/tools/Composite.h>
+#include <openvdb/tools/LevelSetUtil.h>
 #include <openvdb/tools/MeshToVolume.h>
+#include <openvdb/tools/Prune.h>
 
 #include <fstream>
 
@@ -25,9 +31,123 @@ static SimpleTransform make_transform(glm::vec3 voxel_grid_resolution,
     return SimpleTransform(scale, translate);
 }
 
+///
+/// \brief Get the voxels inside a mesh from its signed distance. Voxels less
+/// than half a voxel outside the surface count as inside, too.
+///
+static openvdb::MaskGrid::Ptr
+interior_mask(openvdb::FloatGrid const& distance) {
+    TraceZone zone("interior mask");
+
+    auto inside = openvdb::tools::sdfInteriorMask(distance, 0.5F);
+
+    auto mask = openvdb::MaskGrid::create();
+    mask->topologyUnion(*inside);
+
+    return mask;
+}
+
+///
+/// \brief The MeshVolume struct is the voxelized inside of one or more meshes
+///
+struct MeshVolume {
+    openvdb::MaskGrid::Ptr  interior;
+    openvdb::FloatGrid::Ptr distance; ///< Signed distance, if kept; or null
+};
+
+///
+/// \brief Voxelize a mesh, or anything else that fits the OpenVDB mesh adapter
+/// concept
+///
+/// \param keep_distance Keep the signed distance too. It then covers the whole
+/// interior, not just a band a voxel deep.
+///
+template <class Mesh>
+static MeshVolume voxelize_one(Mesh const& mesh, bool keep_distance) {
+    float const interior_band =
+        keep_distance ? std::numeric_limits<float>::max() : 1.0F;
+
+    openvdb::FloatGrid::Ptr distance;
+
+    {
+        TraceZone mesh_zone("meshToVolume");
+
+        distance = openvdb::tools::meshToVolume<openvdb::FloatGrid>(
+            mesh, {}, 1.0F, interior_band);
+    }
+
+    MeshVolume volume { interior_mask(*distance), nullptr };
+
+    if (keep_distance) volume.distance = distance;
+
+    return volume;
+}
+
+///
+/// \brief Intersect one mesh volume with another, which is consumed
+///
+static void intersect(MeshVolume& a, MeshVolume& b) {
+    a.interior->topologyIntersection(*b.interior);
+
+    if (a.distance) {
+        TraceZone merge_zone("compMax");
+
+        // the distance to an intersection is the max of the distances
+        openvdb::tools::compMax(*a.distance, *b.distance);
+    }
+}
+
+///
+/// \brief Find the voxels inside every mesh
+///
+/// Meshes are voxelized in parallel. Each job folds its meshes into one volume
+/// as it goes, so only a volume per job is alive, not one per mesh.
+///
+static MeshVolume intersect_meshes(std::vector<MutableObject> const& objects,
+                                   bool keep_distance) {
+    constexpr size_t MESHES_PER_JOB = 16;
+
+    std::vector<MutableMesh const*> meshes;
+
+    for (auto const& o : objects) {
+        for (auto const& m : o.meshes) {
+            meshes.push_back(&m);
+        }
+    }
+
+    if (meshes.empty()) {
+        return { openvdb::MaskGrid::create(),
+                 keep_distance ? openvdb::FloatGrid::create(1.0F) : nullptr };
+    }
+
+    std::vector<MeshVolume> partial((meshes.size() + MESHES_PER_JOB - 1) /
+                                    MESHES_PER_JOB);
+
+    parallel_for(meshes.size(), MESHES_PER_JOB, [&](size_t begin, size_t end) {
+        auto& result = partial[begin / MESHES_PER_JOB];
+
+        for (size_t i : xrange(begin, end)) {
+            auto volume = voxelize_one(*meshes[i], keep_distance);
+
+            if (!result.interior) {
+                result = volume;
+            } else {
+                intersect(result, volume);
+            }
+        }
+    });
+
+    for (size_t i : xrange<size_t>(1, partial.size())) {
+        intersect(partial[0], partial[i]);
+    }
+
+    return partial[0];
+}
 
 VoxelResult voxelize(std::vector<MutableObject>&& objects, double voxel_size) {
 
+    TraceZone zone("voxelize");
+
     BoundingBox total_bb;
 
     for (auto const& o : objects) {
@@ -66,43 +186,46 @@ VoxelResult voxelize(std::vector<MutableObject>&& objects, double voxel_size) {
 
     fmt::print("Starting object voxelization\n");
 
-    auto volume_fraction =
-        openvdb::FloatGrid::create(std::numeric_limits<int>::lowest());
+    openvdb::CoordBBox const domain(0,
+                                    0,
+                                    0,
+                                    voxel_grid_resolution.x,
+                                    voxel_grid_resolution.y,
+                                    voxel_grid_resolution.z);
 
-    {
-        openvdb::CoordBBox cbb(0,
-                               0,
-                               0,
-                               voxel_grid_resolution.x,
-                               voxel_grid_resolution.y,
-                               voxel_grid_resolution.z);
-        volume_fraction->sparseFill(cbb, 0.0F);
-    }
+    bool const keep_distance =
+        global_configuration().distance_engine == DistanceEngine::SDF;
 
+    MeshVolume volume;
 
-    for (auto const& o : objects) {
-        for (auto const& m : o.meshes) {
-            auto ptr = openvdb::tools::meshToVolume<openvdb::FloatGrid>(
-                m, {}, 1.0f, 1.0f);
+    size_t const budget = global_configuration().voxel_memory_budget;
 
-            openvdb::tools::compMax(*volume_fraction, *ptr);
-        }
-    }
+    if (budget > 0) {
+        // budget is in MiB
+        volume.interior = voxelize_tiled(objects, domain.max(), budget << 20U);
+    } else if (global_configuration().mesh_combine == MeshCombine::UNION) {
+        MeshSoup soup(objects);
 
+        fmt::print("Voxelizing {} meshes as one\n", soup.mesh_count());
 
-    openvdb::tools::foreach (volume_fraction->beginValueOn(),
-                             [](auto const& iter) {
-                                 float value = *iter;
+        volume = voxelize_one(soup, keep_distance);
+    } else {
+        volume = intersect_meshes(objects, keep_distance);
+    }
+
+    auto& interior = volume.interior;
 
-                                 iter.setValue(value < .5 ? 1.0F : -1.0F);
-                             });
+    interior->clip(domain);
 
+    {
+        TraceZone prune_zone("prune");
 
-    openvdb::tools::prune(volume_fraction->tree());
+        openvdb::tools::prune(interior->tree());
+    }
 
     {
-        auto bb = volume_fraction->evalActiveVoxelBoundingBox();
-        fmt::print("Volume fraction computed: {} {} {} x {} {} {}\n",
+        auto bb = interior->evalActiveVoxelBoundingBox();
+        fmt::print("Interior computed: {} {} {} x {} {} {}\n",
                    bb.min().x(),
                    bb.min().y(),
                    bb.min().z(),
@@ -110,9 +233,13 @@ VoxelResult voxelize(std::vector<MutableObject>&& objects, double voxel_size) {
                    bb.max().y(),
                    bb.max().z());
 
-        fmt::print("Volume fraction bytes {}\n", volume_fraction->memUsage());
+        fmt::print("Interior bytes {}\n", interior->memUsage());
+
+        if (volume.distance) {
+            fmt::print("Distance bytes {}\n", volume.distance->memUsage());
+        }
     }
 
 
-    return { volume_fraction, tf };
+    return { interior, domain, volume.distance, tf };
 }
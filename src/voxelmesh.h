@@ -35,8 +35,16 @@ public:
 };
 
 struct VoxelResult {
-    // Grid3D<bool> voxels;
-    openvdb::FloatGrid::Ptr distance_voxels;
+    /// Voxels inside the mesh. Only these are active, and uniform regions are
+    /// tiles.
+    openvdb::MaskGrid::Ptr interior;
+
+    /// Box that was voxelized. Inactive voxels in it are outside the mesh.
+    openvdb::CoordBBox domain;
+
+    /// Signed distance to the mesh, negative inside, over the whole interior.
+    /// Only kept for the sdf distance engine; null otherwise.
+    openvdb::FloatGrid::Ptr distance;
 
     SimpleTransform tf;
 };
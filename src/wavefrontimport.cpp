@@ -2,6 +2,7 @@
 
 #include "global.h"
 #include "mutable_mesh.h"
+#include "trace.h"
 #include "wavefrontimport.h"
 #include "xrange.h"
 
@@ -302,6 +303,8 @@ public:
 };
 
 ImportedMesh import_wavefront(std::filesystem::path const& path) {
+    TraceZone zone("import");
+
     WaveFrontConverterData cv(path);
     cv.check();
 